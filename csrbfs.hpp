@@ -0,0 +1,321 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <queue>
+#include <vector>
+
+#include "csrgraph.hpp"
+#include "narena.hpp"
+#include "nflat.hpp"
+#include "nutility.hpp"
+
+/*
+	Обход в ширину по CsrGraph с выбором направления (direction-optimizing BFS) и
+	извлечение остовного дерева обхода.
+
+	Пока фронт маленький, уровень раскрывается сверху вниз: вершины фронта просматривают своих
+	соседей. Когда рёбер из фронта становится больше, чем из ещё не посещённых вершин (с
+	коэффициентом ALPHA), обход переключается снизу вверх: каждая непосещённая вершина ищет
+	родителя среди соседей и останавливается на первом найденном во фронте, что на больших
+	уровнях просматривает во много раз меньше рёбер. Когда фронт снова сужается (меньше
+	1 / BETA вершин), обход возвращается сверху вниз. Фронт снизу вверх хранится битовой картой.
+
+	Шаг снизу вверх смотрит на входящие рёбра. Для неориентированного графа это те же рёбра,
+	для ориентированного нужно передать транспонированный граф transpose.
+*/
+template<typename V, typename E = float>
+class CsrBfs
+{
+public:
+	static constexpr uint64_t INVALID_VERTEX = CsrGraph<V, E>::INVALID_VERTEX;
+private:
+	// Пороги переключения направления (Beamer и др.).
+	static constexpr uint64_t ALPHA = 15;
+	static constexpr uint64_t BETA = 18;
+
+	// Диапазоны меньше этого размера не делятся между потоками.
+	static constexpr size_t PARALLEL_RANGE_SIZE = 4096;
+public:
+	/*
+		Обход из source. Возвращает массив родителей: parents[source] = source, у недостижимых
+		вершин INVALID_VERTEX. Уровни раскрываются в threads потоков. Уровни вершин от числа потоков
+		не зависят, а родитель среди нескольких соседей предыдущего уровня при threads > 1 может
+		выбираться по-разному от запуска к запуску.
+	*/
+	static std::vector<uint64_t> Run(const CsrGraph<V, E>& graph, uint64_t source, uint16_t threads = 1, const CsrGraph<V, E>* transpose = nullptr)
+	{
+		uint64_t vertexAmount = graph.GetVertexAmount();
+
+		std::vector<uint64_t> parents(vertexAmount, INVALID_VERTEX);
+		if (source >= vertexAmount)
+		{
+			return parents;
+		}
+
+		const CsrGraph<V, E>& incoming = (transpose != nullptr) ? *transpose : graph;
+
+		parents[source] = source;
+
+		// Фронт в виде списка (сверху вниз) или битовой карты (снизу вверх).
+		std::vector<uint64_t> frontier = { source };
+		std::vector<uint64_t> frontierBits((vertexAmount + 63) / 64, 0);
+		bool bottomUp = false;
+
+		// Рёбра из фронта и из ещё не посещённых вершин.
+		uint64_t frontierEdges = graph.GetDegree(source);
+		uint64_t unvisitedEdges = graph.GetEdgeAmount() - frontierEdges;
+		uint64_t frontierSize = 1;
+
+		while (frontierSize > 0)
+		{
+			if (!bottomUp && frontierEdges > unvisitedEdges / ALPHA)
+			{
+				bottomUp = true;
+
+				std::fill(frontierBits.begin(), frontierBits.end(), 0);
+				for (uint64_t vertex : frontier)
+				{
+					frontierBits[vertex / 64] |= (uint64_t)1 << (vertex % 64);
+				}
+			}
+			else if (bottomUp && frontierSize < vertexAmount / BETA)
+			{
+				bottomUp = false;
+
+				frontier.clear();
+				for (uint64_t vertex = 0; vertex < vertexAmount; vertex++)
+				{
+					if (frontierBits[vertex / 64] & ((uint64_t)1 << (vertex % 64)))
+					{
+						frontier.push_back(vertex);
+					}
+				}
+			}
+
+			uint64_t nextEdges = 0;
+
+			if (bottomUp)
+			{
+				frontierSize = StepBottomUp(incoming, parents, frontierBits, graph, nextEdges, threads);
+			}
+			else
+			{
+				StepTopDown(graph, parents, frontier, nextEdges, threads);
+				frontierSize = frontier.size();
+			}
+
+			frontierEdges = nextEdges;
+			unvisitedEdges -= std::min(unvisitedEdges, nextEdges);
+		}
+
+		return parents;
+	}
+
+	/*
+		Остовное дерево обхода из source в виде NTree со значениями вершин. Потомки каждого лепестка
+		идут по возрастанию номеров вершин. Если передан arena, то лепестки выделяются в нём.
+		Возвращает nullptr, если у какой-то вершины в дереве больше N детей: тогда нужен SpanningFlatTree.
+	*/
+	template<uint16_t N>
+	static NLeaf<V, N>* SpanningTree(const CsrGraph<V, E>& graph, uint64_t source, uint16_t threads = 1, const CsrGraph<V, E>* transpose = nullptr, NArena<V, N>* arena = nullptr)
+	{
+		std::vector<uint64_t> parents = Run(graph, source, threads, transpose);
+		if (source >= parents.size())
+		{
+			return nullptr;
+		}
+
+		std::vector<uint64_t> offsets = {};
+		std::vector<uint64_t> children = {};
+		CollectChildren(parents, source, offsets, children);
+
+		for (uint64_t vertex = 0; vertex < parents.size(); vertex++)
+		{
+			if (offsets[vertex + 1] - offsets[vertex] > N)
+			{
+				return nullptr;
+			}
+		}
+
+		// Построение по уровням, как в NLeaf::Deserialize.
+		NLeaf<V, N>* result = nullptr;
+
+		std::queue<std::pair<uint64_t, leaf_generation_data_t<V, N>>> toPopulate = {};
+		toPopulate.push({ source, { &result, nullptr, 0 } });
+
+		while (toPopulate.size() > 0)
+		{
+			uint64_t vertex = toPopulate.front().first;
+			const leaf_generation_data_t<V, N>& leafData = toPopulate.front().second;
+
+			(*leafData.output) = (arena != nullptr) ? arena->Allocate(graph.GetValue(vertex)) : new NLeaf<V, N>(graph.GetValue(vertex));
+
+			if (leafData.parent != nullptr)
+			{
+				leafData.parent->SetNChild(leafData.childIndex, (*leafData.output));
+			}
+
+			for (uint64_t c = offsets[vertex]; c < offsets[vertex + 1]; c++)
+			{
+				toPopulate.push({ children[c], { (*leafData.output)->GetNChild((uint16_t)(c - offsets[vertex])), (*leafData.output), (uint16_t)(c - offsets[vertex]) } });
+			}
+
+			toPopulate.pop();
+		}
+
+		return result;
+	}
+
+	// Остовное дерево обхода из source в плоском виде, без ограничения на количество детей.
+	static NFlatTree<V> SpanningFlatTree(const CsrGraph<V, E>& graph, uint64_t source, uint16_t threads = 1, const CsrGraph<V, E>* transpose = nullptr)
+	{
+		std::vector<uint64_t> parents = Run(graph, source, threads, transpose);
+		if (source >= parents.size())
+		{
+			return NFlatTree<V>();
+		}
+
+		std::vector<uint64_t> offsets = {};
+		std::vector<uint64_t> children = {};
+		CollectChildren(parents, source, offsets, children);
+
+		// Нумерация в порядке обхода в ширину по тому же порядку, что и в SpanningTree.
+		std::vector<uint64_t> order = { source };
+		std::vector<uint64_t> flatParents = { NFlatTree<V>::INVALID_LEAF };
+		std::vector<V> values = {};
+
+		for (uint64_t p = 0; p < order.size(); p++)
+		{
+			uint64_t vertex = order[p];
+			values.push_back(graph.GetValue(vertex));
+
+			for (uint64_t c = offsets[vertex]; c < offsets[vertex + 1]; c++)
+			{
+				order.push_back(children[c]);
+				flatParents.push_back(p);
+			}
+		}
+
+		return NFlatTree<V>::FromBfsOrder(flatParents, values);
+	}
+private:
+	// Шаг сверху вниз: соседи вершин фронта без родителя захватываются через CAS.
+	static void StepTopDown(const CsrGraph<V, E>& graph, std::vector<uint64_t>& parents, std::vector<uint64_t>& frontier, uint64_t& nextEdges, uint16_t threads)
+	{
+		std::vector<std::vector<uint64_t>> nexts(std::max<uint16_t>(threads, 1));
+		std::vector<uint64_t> edges(nexts.size(), 0);
+
+		NParallel::ForRange(frontier.size(), threads, PARALLEL_RANGE_SIZE, [&](size_t begin, size_t end, size_t worker) {
+			for (size_t f = begin; f < end; f++)
+			{
+				uint64_t vertex = frontier[f];
+
+				graph.ForEachEdge(vertex, [&](uint64_t target, E) {
+					std::atomic_ref<uint64_t> parent(parents[target]);
+
+					uint64_t expected = INVALID_VERTEX;
+					if (parent.load(std::memory_order_relaxed) == INVALID_VERTEX && parent.compare_exchange_strong(expected, vertex, std::memory_order_relaxed))
+					{
+						nexts[worker].push_back(target);
+						edges[worker] += graph.GetDegree(target);
+					}
+				});
+			}
+		});
+
+		frontier.clear();
+		nextEdges = 0;
+
+		for (size_t w = 0; w < nexts.size(); w++)
+		{
+			frontier.insert(frontier.end(), nexts[w].begin(), nexts[w].end());
+			nextEdges += edges[w];
+		}
+	}
+
+	/*
+		Шаг снизу вверх: каждая непосещённая вершина ищет первого соседа во фронте.
+		Потоки получают диапазоны, кратные 64 вершинам, поэтому каждое слово новой карты пишет один поток.
+	*/
+	static uint64_t StepBottomUp(const CsrGraph<V, E>& incoming, std::vector<uint64_t>& parents, std::vector<uint64_t>& frontierBits, const CsrGraph<V, E>& graph, uint64_t& nextEdges, uint16_t threads)
+	{
+		std::vector<uint64_t> nextBits(frontierBits.size(), 0);
+		std::vector<uint64_t> sizes(std::max<uint16_t>(threads, 1), 0);
+		std::vector<uint64_t> edges(sizes.size(), 0);
+
+		NParallel::ForRange(frontierBits.size(), threads, PARALLEL_RANGE_SIZE, [&](size_t begin, size_t end, size_t worker) {
+			for (size_t word = begin; word < end; word++)
+			{
+				uint64_t vertexEnd = std::min<uint64_t>((word + 1) * 64, parents.size());
+
+				for (uint64_t vertex = word * 64; vertex < vertexEnd; vertex++)
+				{
+					if (parents[vertex] != INVALID_VERTEX)
+					{
+						continue;
+					}
+
+					for (uint64_t index = 0; index < incoming.GetDegree(vertex); index++)
+					{
+						uint64_t neighbor = incoming.GetTarget(vertex, index);
+
+						if (frontierBits[neighbor / 64] & ((uint64_t)1 << (neighbor % 64)))
+						{
+							parents[vertex] = neighbor;
+							nextBits[word] |= (uint64_t)1 << (vertex % 64);
+
+							sizes[worker]++;
+							edges[worker] += graph.GetDegree(vertex);
+							break;
+						}
+					}
+				}
+			}
+		});
+
+		frontierBits.swap(nextBits);
+
+		uint64_t frontierSize = 0;
+		nextEdges = 0;
+
+		for (size_t w = 0; w < sizes.size(); w++)
+		{
+			frontierSize += sizes[w];
+			nextEdges += edges[w];
+		}
+
+		return frontierSize;
+	}
+
+	// Потомки каждой вершины в дереве обхода (CSR по массиву родителей), по возрастанию номеров.
+	static void CollectChildren(const std::vector<uint64_t>& parents, uint64_t source, std::vector<uint64_t>& offsets, std::vector<uint64_t>& children)
+	{
+		offsets.assign(parents.size() + 1, 0);
+
+		for (uint64_t vertex = 0; vertex < parents.size(); vertex++)
+		{
+			if (vertex != source && parents[vertex] != INVALID_VERTEX)
+			{
+				offsets[parents[vertex] + 1]++;
+			}
+		}
+
+		for (uint64_t vertex = 0; vertex < parents.size(); vertex++)
+		{
+			offsets[vertex + 1] += offsets[vertex];
+		}
+
+		children.resize(offsets[parents.size()]);
+		std::vector<uint64_t> cursors(offsets.begin(), offsets.end() - 1);
+
+		for (uint64_t vertex = 0; vertex < parents.size(); vertex++)
+		{
+			if (vertex != source && parents[vertex] != INVALID_VERTEX)
+			{
+				children[cursors[parents[vertex]]++] = vertex;
+			}
+		}
+	}
+};
@@ -0,0 +1,418 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <queue>
+#include <random>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "csrgraph.hpp"
+#include "narena.hpp"
+#include "nflat.hpp"
+#include "nutility.hpp"
+
+/*
+	Компоненты связности CsrGraph (для ориентированного графа - слабой связности) и
+	разбиение графа на лес остовных деревьев, по дереву на компоненту.
+
+	Компоненты ищутся параллельным union-find без блокировок: корень с большим номером
+	подвешивается к корню с меньшим через CAS, а при неудаче поиск корней повторяется. Так как
+	связи идут только к меньшим номерам, циклов не бывает, и меткой компоненты оказывается её
+	наименьшая вершина. Поиск корня сокращает пути делением пополам.
+
+	Если каждое ребро хранится в обе стороны (флаг symmetric, граф построен с undirected), то
+	рёбра обрабатываются как в Afforest: сначала по NEIGHBOR_ROUNDS первых рёбер каждой вершины,
+	затем выборкой вершин ищется самая большая из уже собранных компонент, и вершины из неё
+	остальные рёбра не просматривают. Без symmetric пропуск неверен, и рёбра просто
+	обрабатываются все за один проход.
+
+	Каждое успешное подвешивание объединяет две компоненты по одному ребру графа, поэтому
+	такие рёбра образуют остовный лес, из которого строятся деревья Forest и FlatForest. Метки
+	от количества потоков не зависят, а форма деревьев при threads > 1 может меняться от запуска
+	к запуску: какое из рёбер объединит две компоненты, решает гонка потоков.
+*/
+template<typename V, typename E = float>
+class CsrComponents
+{
+public:
+	static constexpr uint64_t INVALID_VERTEX = CsrGraph<V, E>::INVALID_VERTEX;
+private:
+	// Ребро остовного леса.
+	using forest_edge_t = std::pair<uint64_t, uint64_t>;
+
+	// Сколько первых рёбер каждой вершины обрабатывается до поиска самой большой компоненты.
+	static constexpr uint64_t NEIGHBOR_ROUNDS = 2;
+
+	// Размер выборки вершин для поиска самой большой компоненты.
+	static constexpr uint64_t SAMPLE_SIZE = 1024;
+
+	// Диапазоны меньше этого размера не делятся между потоками.
+	static constexpr size_t PARALLEL_RANGE_SIZE = 4096;
+public:
+	/*
+		Метки компонент: labels[v] - наименьшая вершина компоненты v. Результат не зависит от
+		количества потоков threads.
+	*/
+	static std::vector<uint64_t> Label(const CsrGraph<V, E>& graph, uint16_t threads = 1, bool symmetric = false)
+	{
+		return Unite(graph, threads, symmetric, nullptr);
+	}
+
+	// Количество компонент по меткам из Label.
+	static uint64_t CountComponents(const std::vector<uint64_t>& labels)
+	{
+		uint64_t amount = 0;
+
+		for (uint64_t vertex = 0; vertex < labels.size(); vertex++)
+		{
+			if (labels[vertex] == vertex)
+			{
+				amount++;
+			}
+		}
+
+		return amount;
+	}
+
+	/*
+		Лес остовных деревьев, по одному NTree на компоненту, в порядке наименьших вершин
+		компонент. Корень дерева - наименьшая вершина, значения лепестков - значения вершин,
+		потомки идут по возрастанию номеров вершин. Если передан arena, то лепестки выделяются в нём.
+		Вместо дерева компоненты, где у какой-то вершины больше N детей, стоит nullptr: такие
+		компоненты можно взять из FlatForest.
+	*/
+	template<uint16_t N>
+	static std::vector<NLeaf<V, N>*> Forest(const CsrGraph<V, E>& graph, uint16_t threads = 1, bool symmetric = false, NArena<V, N>* arena = nullptr)
+	{
+		std::vector<uint64_t> roots = {};
+		std::vector<uint64_t> offsets = {};
+		std::vector<uint64_t> children = {};
+		BuildForest(graph, threads, symmetric, roots, offsets, children);
+
+		std::vector<NLeaf<V, N>*> result(roots.size(), nullptr);
+
+		for (size_t r = 0; r < roots.size(); r++)
+		{
+			// Сначала проверка ширины всей компоненты, чтобы не строить дерево впустую.
+			bool fits = true;
+
+			std::vector<uint64_t> order = { roots[r] };
+			for (uint64_t p = 0; p < order.size() && fits; p++)
+			{
+				fits = offsets[order[p] + 1] - offsets[order[p]] <= N;
+				order.insert(order.end(), children.begin() + offsets[order[p]], children.begin() + offsets[order[p] + 1]);
+			}
+
+			if (!fits)
+			{
+				continue;
+			}
+
+			// Построение по уровням, как в NLeaf::Deserialize.
+			std::queue<std::pair<uint64_t, leaf_generation_data_t<V, N>>> toPopulate = {};
+			toPopulate.push({ roots[r], { &result[r], nullptr, 0 } });
+
+			while (toPopulate.size() > 0)
+			{
+				uint64_t vertex = toPopulate.front().first;
+				const leaf_generation_data_t<V, N>& leafData = toPopulate.front().second;
+
+				(*leafData.output) = (arena != nullptr) ? arena->Allocate(graph.GetValue(vertex)) : new NLeaf<V, N>(graph.GetValue(vertex));
+
+				if (leafData.parent != nullptr)
+				{
+					leafData.parent->SetNChild(leafData.childIndex, (*leafData.output));
+				}
+
+				for (uint64_t c = offsets[vertex]; c < offsets[vertex + 1]; c++)
+				{
+					toPopulate.push({ children[c], { (*leafData.output)->GetNChild((uint16_t)(c - offsets[vertex])), (*leafData.output), (uint16_t)(c - offsets[vertex]) } });
+				}
+
+				toPopulate.pop();
+			}
+		}
+
+		return result;
+	}
+
+	// Тот же лес в плоском виде, без ограничения на количество детей. Деревья строятся в threads потоков.
+	static std::vector<NFlatTree<V>> FlatForest(const CsrGraph<V, E>& graph, uint16_t threads = 1, bool symmetric = false)
+	{
+		std::vector<uint64_t> roots = {};
+		std::vector<uint64_t> offsets = {};
+		std::vector<uint64_t> children = {};
+		BuildForest(graph, threads, symmetric, roots, offsets, children);
+
+		std::vector<NFlatTree<V>> result(roots.size());
+
+		// Деревья независимы, поэтому компоненты делятся между потоками целиком.
+		NParallel::ForRange(roots.size(), threads, PARALLEL_RANGE_SIZE, [&](size_t begin, size_t end, size_t) {
+			for (size_t r = begin; r < end; r++)
+			{
+				std::vector<uint64_t> order = { roots[r] };
+				std::vector<uint64_t> parents = { NFlatTree<V>::INVALID_LEAF };
+				std::vector<V> values = {};
+
+				for (uint64_t p = 0; p < order.size(); p++)
+				{
+					uint64_t vertex = order[p];
+					values.push_back(graph.GetValue(vertex));
+
+					for (uint64_t c = offsets[vertex]; c < offsets[vertex + 1]; c++)
+					{
+						order.push_back(children[c]);
+						parents.push_back(p);
+					}
+				}
+
+				result[r] = NFlatTree<V>::FromBfsOrder(parents, values);
+			}
+		});
+
+		return result;
+	}
+private:
+	/*
+		Объединение вершин по всем рёбрам. Возвращает метки компонент. Если передан forest,
+		то в него складываются рёбра, по которым прошли успешные подвешивания.
+	*/
+	static std::vector<uint64_t> Unite(const CsrGraph<V, E>& graph, uint16_t threads, bool symmetric, std::vector<forest_edge_t>* forest)
+	{
+		uint64_t vertexAmount = graph.GetVertexAmount();
+
+		std::vector<uint64_t> parents(vertexAmount);
+		for (uint64_t vertex = 0; vertex < vertexAmount; vertex++)
+		{
+			parents[vertex] = vertex;
+		}
+
+		std::vector<std::vector<forest_edge_t>> links(std::max<uint16_t>(threads, 1));
+
+		// Самая большая компонента по выборке. Её вершинам остальные рёбра уже ничего не добавят.
+		uint64_t largest = INVALID_VERTEX;
+		uint64_t firstEdge = 0;
+
+		if (symmetric && vertexAmount > 0)
+		{
+			// Первые рёбра каждой вершины: этого обычно хватает, чтобы собрать большую часть крупных компонент.
+			for (uint64_t round = 0; round < NEIGHBOR_ROUNDS; round++)
+			{
+				NParallel::ForRange(vertexAmount, threads, PARALLEL_RANGE_SIZE, [&](size_t begin, size_t end, size_t worker) {
+					for (uint64_t vertex = begin; vertex < end; vertex++)
+					{
+						if (round < graph.GetDegree(vertex))
+						{
+							Link(parents, vertex, graph.GetTarget(vertex, round), (forest != nullptr) ? &links[worker] : nullptr);
+						}
+					}
+				});
+			}
+
+			firstEdge = NEIGHBOR_ROUNDS;
+
+			std::mt19937_64 random(vertexAmount);
+			std::unordered_map<uint64_t, uint64_t> counts = {};
+			uint64_t largestCount = 0;
+
+			for (uint64_t s = 0; s < SAMPLE_SIZE; s++)
+			{
+				uint64_t label = Find(parents, random() % vertexAmount);
+				uint64_t count = ++counts[label];
+
+				if (count > largestCount)
+				{
+					largest = label;
+					largestCount = count;
+				}
+			}
+		}
+
+		// Остальные рёбра. Без symmetric это просто все рёбра графа.
+		NParallel::ForRange(vertexAmount, threads, PARALLEL_RANGE_SIZE, [&](size_t begin, size_t end, size_t worker) {
+			for (uint64_t vertex = begin; vertex < end; vertex++)
+			{
+				if (graph.GetDegree(vertex) <= firstEdge || (largest != INVALID_VERTEX && Find(parents, vertex) == largest))
+				{
+					continue;
+				}
+
+				for (uint64_t index = firstEdge; index < graph.GetDegree(vertex); index++)
+				{
+					Link(parents, vertex, graph.GetTarget(vertex, index), (forest != nullptr) ? &links[worker] : nullptr);
+				}
+			}
+		});
+
+		Compress(parents, threads);
+
+		if (forest != nullptr)
+		{
+			for (std::vector<forest_edge_t>& workerLinks : links)
+			{
+				forest->insert(forest->end(), workerLinks.begin(), workerLinks.end());
+			}
+		}
+
+		return parents;
+	}
+
+	// Корень вершины с сокращением пути делением пополам. Вершина в ходе поиска поднимается только к своему предку.
+	static uint64_t Find(std::vector<uint64_t>& parents, uint64_t vertex)
+	{
+		while (true)
+		{
+			uint64_t parent = std::atomic_ref<uint64_t>(parents[vertex]).load(std::memory_order_relaxed);
+			if (parent == vertex)
+			{
+				return vertex;
+			}
+
+			uint64_t grandParent = std::atomic_ref<uint64_t>(parents[parent]).load(std::memory_order_relaxed);
+			if (grandParent != parent)
+			{
+				std::atomic_ref<uint64_t>(parents[vertex]).store(grandParent, std::memory_order_relaxed);
+			}
+
+			vertex = grandParent;
+		}
+	}
+
+	// Объединение компонент двух вершин: корень с большим номером подвешивается к корню с меньшим.
+	static void Link(std::vector<uint64_t>& parents, uint64_t first, uint64_t second, std::vector<forest_edge_t>* links)
+	{
+		while (true)
+		{
+			uint64_t firstRoot = Find(parents, first);
+			uint64_t secondRoot = Find(parents, second);
+
+			if (firstRoot == secondRoot)
+			{
+				return;
+			}
+
+			if (firstRoot < secondRoot)
+			{
+				std::swap(firstRoot, secondRoot);
+			}
+
+			uint64_t expected = firstRoot;
+			if (std::atomic_ref<uint64_t>(parents[firstRoot]).compare_exchange_strong(expected, secondRoot, std::memory_order_relaxed))
+			{
+				if (links != nullptr)
+				{
+					links->push_back({ first, second });
+				}
+
+				return;
+			}
+		}
+	}
+
+	// Подвешивание каждой вершины прямо к корню.
+	static void Compress(std::vector<uint64_t>& parents, uint16_t threads)
+	{
+		NParallel::ForRange(parents.size(), threads, PARALLEL_RANGE_SIZE, [&](size_t begin, size_t end, size_t) {
+			for (uint64_t vertex = begin; vertex < end; vertex++)
+			{
+				std::atomic_ref<uint64_t>(parents[vertex]).store(Find(parents, vertex), std::memory_order_relaxed);
+			}
+		});
+	}
+
+	/*
+		Остовный лес в виде потомков каждой вершины (CSR по offsets и children, потомки по
+		возрастанию номеров) и корни деревьев - наименьшие вершины компонент по возрастанию.
+	*/
+	static void BuildForest(const CsrGraph<V, E>& graph, uint16_t threads, bool symmetric, std::vector<uint64_t>& roots, std::vector<uint64_t>& offsets, std::vector<uint64_t>& children)
+	{
+		uint64_t vertexAmount = graph.GetVertexAmount();
+
+		std::vector<forest_edge_t> forest = {};
+		std::vector<uint64_t> labels = Unite(graph, threads, symmetric, &forest);
+
+		// Рёбра леса без направления: CSR, где каждое ребро записано в обе стороны.
+		std::vector<uint64_t> adjacencyOffsets(vertexAmount + 1, 0);
+		for (const forest_edge_t& edge : forest)
+		{
+			adjacencyOffsets[edge.first + 1]++;
+			adjacencyOffsets[edge.second + 1]++;
+		}
+
+		for (uint64_t vertex = 0; vertex < vertexAmount; vertex++)
+		{
+			adjacencyOffsets[vertex + 1] += adjacencyOffsets[vertex];
+		}
+
+		std::vector<uint64_t> adjacency(adjacencyOffsets[vertexAmount]);
+		std::vector<uint64_t> cursors(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+
+		for (const forest_edge_t& edge : forest)
+		{
+			adjacency[cursors[edge.first]++] = edge.second;
+			adjacency[cursors[edge.second]++] = edge.first;
+		}
+
+		// Направление рёбер от корня: обход в ширину по лесу из наименьшей вершины каждой компоненты.
+		std::vector<uint64_t> parents(vertexAmount, INVALID_VERTEX);
+		std::vector<uint64_t> order = {};
+		order.reserve(vertexAmount);
+
+		roots.clear();
+
+		for (uint64_t vertex = 0; vertex < vertexAmount; vertex++)
+		{
+			if (labels[vertex] != vertex)
+			{
+				continue;
+			}
+
+			roots.push_back(vertex);
+			parents[vertex] = vertex;
+
+			size_t first = order.size();
+			order.push_back(vertex);
+
+			for (size_t p = first; p < order.size(); p++)
+			{
+				for (uint64_t a = adjacencyOffsets[order[p]]; a < adjacencyOffsets[order[p] + 1]; a++)
+				{
+					if (parents[adjacency[a]] == INVALID_VERTEX)
+					{
+						parents[adjacency[a]] = order[p];
+						order.push_back(adjacency[a]);
+					}
+				}
+			}
+		}
+
+		// Потомки по родителям: проход по вершинам по возрастанию даёт потомков по возрастанию номеров.
+		offsets.assign(vertexAmount + 1, 0);
+		for (uint64_t vertex = 0; vertex < vertexAmount; vertex++)
+		{
+			if (parents[vertex] != vertex)
+			{
+				offsets[parents[vertex] + 1]++;
+			}
+		}
+
+		for (uint64_t vertex = 0; vertex < vertexAmount; vertex++)
+		{
+			offsets[vertex + 1] += offsets[vertex];
+		}
+
+		children.resize(offsets[vertexAmount]);
+		cursors.assign(offsets.begin(), offsets.end() - 1);
+
+		for (uint64_t vertex = 0; vertex < vertexAmount; vertex++)
+		{
+			if (parents[vertex] != vertex)
+			{
+				children[cursors[parents[vertex]]++] = vertex;
+			}
+		}
+	}
+};
@@ -0,0 +1,432 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "csrgraph.hpp"
+#include "nutility.hpp"
+
+/*
+	Генерация больших синтетических графов для нагрузочных тестов: R-MAT (как в Graph500),
+	Эрдёш-Реньи G(n, m) и случайный геометрический граф.
+
+	Случайные числа считаются от сида и номера ребра (или вершины), а не от общего состояния
+	генератора, поэтому любое ребро можно получить независимо от остальных. Отсюда параллельность
+	без синхронизации, одинаковый результат при любом количестве потоков и то, что рёбра не
+	нужно хранить: источники *Edges отдаются прямо в CsrGraph::FromGenerator, который читает
+	их дважды, или пишутся блоками в двоичный файл рёбер через WriteEdges.
+
+	Веса рёбер R-MAT и G(n, m) - целые от 1 до 100, у геометрического графа - длина ребра.
+*/
+template<typename V, typename E = float>
+class CsrGenerator
+{
+public:
+	using edge_t = typename CsrGraph<V, E>::edge_t;
+
+	// Наибольший scale R-MAT: количество вершин 2^scale должно помещаться в uint64_t.
+	static constexpr uint8_t MAX_RMAT_SCALE = 63;
+private:
+	// Вероятности четвертей матрицы смежности в R-MAT (параметры Graph500), четвёртая - остаток.
+	static constexpr double RMAT_A = 0.57;
+	static constexpr double RMAT_B = 0.19;
+	static constexpr double RMAT_C = 0.19;
+
+	// Те же границы четвертей в 32-битных случайных числах.
+	static constexpr uint32_t RMAT_A32 = (uint32_t)(RMAT_A * 4294967296.0);
+	static constexpr uint32_t RMAT_AB = (uint32_t)((RMAT_A + RMAT_B) * 4294967296.0);
+	static constexpr uint32_t RMAT_ABC = (uint32_t)((RMAT_A + RMAT_B + RMAT_C) * 4294967296.0);
+
+	// Заголовок файла рёбер, за ним подряд идут edgeAmount записей edge_t.
+	struct edges_header_t
+	{
+		uint64_t magic;
+		uint64_t edgeSize;
+		uint64_t vertexAmount;
+		uint64_t edgeAmount;
+	};
+
+	static constexpr uint64_t EDGES_MAGIC = 0x3173656764457343; // "CsEdges1"
+
+	// Сколько элементов источника генерируется за раз при записи в файл.
+	static constexpr uint64_t WRITE_BLOCK_SIZE = 1 << 22;
+
+	// Сколько записей читается из файла за раз.
+	static constexpr uint64_t READ_BLOCK_SIZE = 1 << 16;
+
+	// Диапазоны меньше этого размера не делятся между потоками.
+	static constexpr uint64_t PARALLEL_RANGE_SIZE = 4096;
+	// Точки геометрического графа, разложенные по клеткам сетки со стороной не меньше радиуса.
+	struct geometric_data_t
+	{
+		double radius;
+		uint64_t gridSize;
+
+		std::vector<double> x;
+		std::vector<double> y;
+
+		// Вершины клетки c - cellVertices[cellOffsets[c]] .. cellVertices[cellOffsets[c + 1] - 1].
+		std::vector<uint64_t> cellOffsets;
+		std::vector<uint64_t> cellVertices;
+	};
+
+	// Генератор splitmix64 с состоянием от сида и номера: свой поток чисел на каждое ребро или вершину.
+	struct random_t
+	{
+		uint64_t state;
+
+		random_t(uint64_t seed, uint64_t index)
+		{
+			state = Mix(seed ^ Mix(index + 0x632BE59BD9B4E019ULL));
+		}
+
+		uint64_t Next()
+		{
+			state += 0x9E3779B97F4A7C15ULL;
+
+			return Mix(state);
+		}
+
+		// Равномерное число из [0, 1).
+		double NextUnit()
+		{
+			return (Next() >> 11) * (1.0 / 9007199254740992.0);
+		}
+	};
+public:
+	/*
+		Источник рёбер R-MAT на 2^scale вершинах, элемент - одно ребро. Каждое ребро выбирается
+		спуском по четвертям матрицы смежности, номера вершин затем перемешиваются обратимым
+		хешем, чтобы вершины большой степени не собирались в начале. Петли и кратные рёбра возможны.
+		При scale больше MAX_RMAT_SCALE источник не выдаёт рёбер.
+	*/
+	static auto RMatEdges(uint8_t scale, uint64_t seed)
+	{
+		bool valid = scale <= MAX_RMAT_SCALE;
+		uint64_t mask = valid ? ((uint64_t)1 << scale) - 1 : 0;
+		uint64_t offset = Mix(seed) & mask;
+
+		// Обратимое перемешивание в пределах [0, 2^scale): умножение на нечётное, сдвиг с xor, умножение.
+		auto scramble = [=](uint64_t vertex) -> uint64_t {
+			vertex = (vertex * 0xBF58476D1CE4E5B9ULL + offset) & mask;
+			vertex ^= vertex >> ((scale + 1) / 2);
+			vertex = (vertex * 0x94D049BB133111EBULL) & mask;
+
+			return vertex;
+		};
+
+		return [=](uint64_t begin, uint64_t end, auto emit) {
+			for (uint64_t e = begin; e < end && valid; e++)
+			{
+				random_t random(seed, e);
+
+				uint64_t source = 0;
+				uint64_t target = 0;
+				uint64_t bits = 0;
+
+				// На каждый уровень 32 случайных бита: одно число из генератора идёт на два уровня.
+				for (uint8_t level = 0; level < scale; level++)
+				{
+					bits = (level % 2 == 0) ? random.Next() : bits >> 32;
+					uint32_t quadrant = (uint32_t)bits;
+
+					source = (source << 1) | ((quadrant >= RMAT_AB) ? 1 : 0);
+					target = (target << 1) | ((quadrant >= RMAT_A32 && quadrant < RMAT_AB) || quadrant >= RMAT_ABC ? 1 : 0);
+				}
+
+				emit(edge_t{ scramble(source), scramble(target), E(1 + random.Next() % 100) });
+			}
+		};
+	}
+
+	/*
+		Источник рёбер G(n, m): концы каждого ребра равновероятны среди vertexAmount вершин, элемент - одно ребро.
+		Без вершин источник не выдаёт рёбер.
+	*/
+	static auto ErdosRenyiEdges(uint64_t vertexAmount, uint64_t seed)
+	{
+		return [=](uint64_t begin, uint64_t end, auto emit) {
+			for (uint64_t e = begin; e < end && vertexAmount > 0; e++)
+			{
+				random_t random(seed, e);
+
+				uint64_t source = random.Next() % vertexAmount;
+				uint64_t target = random.Next() % vertexAmount;
+
+				emit(edge_t{ source, target, E(1 + random.Next() % 100) });
+			}
+		};
+	}
+
+	/*
+		Источник рёбер случайного геометрического графа: vertexAmount точек равномерно в единичном
+		квадрате, ребро между каждой парой на расстоянии не больше radius. Каждое ребро выдаётся один
+		раз, поэтому граф строится с undirected. Элемент - клетка сетки, их количество - GetCellAmount.
+		Точки раскладываются по клеткам сразу, в threads потоков.
+	*/
+	static auto GeometricEdges(uint64_t vertexAmount, double radius, uint64_t seed, uint16_t threads = 1)
+	{
+		std::shared_ptr<geometric_data_t> data = std::make_shared<geometric_data_t>();
+		data->radius = radius;
+
+		// Клеток не больше, чем вершин, иначе сетка займёт больше памяти, чем точки.
+		double perSide = (radius > 0) ? std::floor(1.0 / radius) : 1.0;
+		data->gridSize = (uint64_t)std::max(1.0, std::min(perSide, std::ceil(std::sqrt((double)vertexAmount))));
+
+		data->x.resize(vertexAmount);
+		data->y.resize(vertexAmount);
+
+		std::vector<uint64_t> cells(vertexAmount);
+
+		NParallel::ForRange(vertexAmount, threads, PARALLEL_RANGE_SIZE, [&](uint64_t begin, uint64_t end) {
+			for (uint64_t v = begin; v < end; v++)
+			{
+				random_t random(seed, v);
+
+				data->x[v] = random.NextUnit();
+				data->y[v] = random.NextUnit();
+
+				cells[v] = Cell(*data, data->x[v]) * data->gridSize + Cell(*data, data->y[v]);
+			}
+		});
+
+		// Раскладка вершин по клеткам подсчётом.
+		uint64_t cellAmount = data->gridSize * data->gridSize;
+		data->cellOffsets.assign(cellAmount + 1, 0);
+
+		for (uint64_t v = 0; v < vertexAmount; v++)
+		{
+			data->cellOffsets[cells[v] + 1]++;
+		}
+
+		for (uint64_t c = 0; c < cellAmount; c++)
+		{
+			data->cellOffsets[c + 1] += data->cellOffsets[c];
+		}
+
+		data->cellVertices.resize(vertexAmount);
+		std::vector<uint64_t> cursors(data->cellOffsets.begin(), data->cellOffsets.end() - 1);
+
+		for (uint64_t v = 0; v < vertexAmount; v++)
+		{
+			data->cellVertices[cursors[cells[v]]++] = v;
+		}
+
+		return [data](uint64_t begin, uint64_t end, auto emit) {
+			const geometric_data_t& grid = *data;
+
+			// Соседние клетки, которые ещё не просмотрены со своей стороны: каждая пара клеток проверяется один раз.
+			const int64_t neighborCells[4][2] = { { 0, 1 }, { 1, -1 }, { 1, 0 }, { 1, 1 } };
+
+			for (uint64_t cell = begin; cell < end; cell++)
+			{
+				int64_t cellX = cell / grid.gridSize;
+				int64_t cellY = cell % grid.gridSize;
+
+				for (uint64_t i = grid.cellOffsets[cell]; i < grid.cellOffsets[cell + 1]; i++)
+				{
+					uint64_t first = grid.cellVertices[i];
+
+					for (uint64_t j = i + 1; j < grid.cellOffsets[cell + 1]; j++)
+					{
+						Connect(grid, first, grid.cellVertices[j], emit);
+					}
+
+					for (const int64_t* delta : neighborCells)
+					{
+						int64_t otherX = cellX + delta[0];
+						int64_t otherY = cellY + delta[1];
+
+						if (otherX < 0 || otherY < 0 || otherX >= (int64_t)grid.gridSize || otherY >= (int64_t)grid.gridSize)
+						{
+							continue;
+						}
+
+						uint64_t other = otherX * grid.gridSize + otherY;
+
+						for (uint64_t j = grid.cellOffsets[other]; j < grid.cellOffsets[other + 1]; j++)
+						{
+							Connect(grid, first, grid.cellVertices[j], emit);
+						}
+					}
+				}
+			}
+		};
+	}
+
+	// Количество клеток (элементов источника) геометрического графа с такими параметрами.
+	static uint64_t GetCellAmount(uint64_t vertexAmount, double radius)
+	{
+		double perSide = (radius > 0) ? std::floor(1.0 / radius) : 1.0;
+		uint64_t gridSize = (uint64_t)std::max(1.0, std::min(perSide, std::ceil(std::sqrt((double)vertexAmount))));
+
+		return gridSize * gridSize;
+	}
+public:
+	// Граф R-MAT на 2^scale вершинах с edgeAmount рёбрами. При scale больше MAX_RMAT_SCALE возвращается пустой граф.
+	static CsrGraph<V, E> RMat(uint8_t scale, uint64_t edgeAmount, uint64_t seed, bool weighted = false, bool undirected = false, uint16_t threads = 1)
+	{
+		if (scale > MAX_RMAT_SCALE)
+		{
+			return CsrGraph<V, E>();
+		}
+
+		return CsrGraph<V, E>::FromGenerator((uint64_t)1 << scale, edgeAmount, RMatEdges(scale, seed), weighted, undirected, threads);
+	}
+
+	// Граф G(n, m) на vertexAmount вершинах с edgeAmount рёбрами. Без вершин граф пуст и рёбер не получает.
+	static CsrGraph<V, E> ErdosRenyi(uint64_t vertexAmount, uint64_t edgeAmount, uint64_t seed, bool weighted = false, bool undirected = false, uint16_t threads = 1)
+	{
+		return CsrGraph<V, E>::FromGenerator(vertexAmount, edgeAmount, ErdosRenyiEdges(vertexAmount, seed), weighted, undirected, threads);
+	}
+
+	// Случайный геометрический граф, всегда неориентированный.
+	static CsrGraph<V, E> Geometric(uint64_t vertexAmount, double radius, uint64_t seed, bool weighted = false, uint16_t threads = 1)
+	{
+		return CsrGraph<V, E>::FromGenerator(vertexAmount, GetCellAmount(vertexAmount, radius), GeometricEdges(vertexAmount, radius, seed, threads), weighted, true, threads);
+	}
+public:
+	/*
+		Запись рёбер источника в двоичный файл: заголовок и записи edge_t подряд. Источник
+		генерируется блоками по WRITE_BLOCK_SIZE элементов в threads потоков, блок пишется в порядке
+		элементов, поэтому файл не зависит от количества потоков. В памяти одновременно только один блок.
+	*/
+	template<typename G>
+	static bool WriteEdges(const std::string& path, uint64_t vertexAmount, uint64_t itemAmount, G generate, uint16_t threads = 1)
+	{
+		std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+		if (!stream.good())
+		{
+			return false;
+		}
+
+		edges_header_t header = { EDGES_MAGIC, sizeof(edge_t), vertexAmount, 0 };
+		stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		std::vector<std::vector<edge_t>> buffers(std::max<uint16_t>(threads, 1));
+
+		for (uint64_t block = 0; block < itemAmount; block += WRITE_BLOCK_SIZE)
+		{
+			uint64_t blockEnd = std::min(block + WRITE_BLOCK_SIZE, itemAmount);
+			uint64_t chunk = (blockEnd - block + buffers.size() - 1) / buffers.size();
+
+			NParallel::ForRange(buffers.size(), threads, 1, [&](uint64_t begin, uint64_t end) {
+				for (uint64_t b = begin; b < end; b++)
+				{
+					buffers[b].clear();
+
+					uint64_t from = std::min(block + b * chunk, blockEnd);
+					uint64_t to = std::min(from + chunk, blockEnd);
+
+					generate(from, to, [&](const edge_t& edge) {
+						buffers[b].push_back(edge);
+					});
+				}
+			});
+
+			for (const std::vector<edge_t>& buffer : buffers)
+			{
+				stream.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(edge_t));
+				header.edgeAmount += buffer.size();
+			}
+		}
+
+		// Количество рёбер известно только в конце: у геометрического графа оно не определяется количеством элементов.
+		stream.seekp(0);
+		stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		return stream.good();
+	}
+
+	/*
+		Построение графа из файла WriteEdges. Рёбра не загружаются в память целиком: каждый поток
+		читает свой диапазон записей блоками по READ_BLOCK_SIZE, файл читается дважды.
+		Если файл не открывается, не подходит или его размер не сходится с заголовком, то возвращается пустой граф.
+	*/
+	static CsrGraph<V, E> ReadEdges(const std::string& path, bool weighted = false, bool undirected = false, uint16_t threads = 1)
+	{
+		edges_header_t header = {};
+
+		std::ifstream stream(path, std::ios::binary);
+		stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+		if (!stream.good() || header.magic != EDGES_MAGIC || header.edgeSize != sizeof(edge_t))
+		{
+			return CsrGraph<V, E>();
+		}
+
+		// Заголовку нельзя верить, пока он не сошёлся с размером файла: по нему выделяется память под вершины.
+		stream.seekg(0, std::ios::end);
+		uint64_t recordSize = (uint64_t)stream.tellg() - sizeof(edges_header_t);
+
+		if (!stream.good() || recordSize % sizeof(edge_t) != 0 || header.edgeAmount != recordSize / sizeof(edge_t))
+		{
+			return CsrGraph<V, E>();
+		}
+
+		// Номер каждой вершины должен помещаться в V.
+		if (header.vertexAmount > 0 && header.vertexAmount - 1 > (uint64_t)std::numeric_limits<V>::max())
+		{
+			return CsrGraph<V, E>();
+		}
+
+		return CsrGraph<V, E>::FromGenerator(header.vertexAmount, header.edgeAmount, [&](uint64_t begin, uint64_t end, auto emit) {
+			std::ifstream input(path, std::ios::binary);
+			input.seekg(sizeof(edges_header_t) + begin * sizeof(edge_t));
+
+			std::vector<edge_t> buffer(READ_BLOCK_SIZE);
+
+			for (uint64_t e = begin; e < end; e += READ_BLOCK_SIZE)
+			{
+				uint64_t amount = std::min(READ_BLOCK_SIZE, end - e);
+				input.read(reinterpret_cast<char*>(buffer.data()), amount * sizeof(edge_t));
+
+				// Обрезанный файл: недостающие записи превращаются в ребро вне графа, и построение отказывает.
+				if (!input.good())
+				{
+					emit(edge_t{ header.vertexAmount, header.vertexAmount, E(0) });
+
+					return;
+				}
+
+				for (uint64_t r = 0; r < amount; r++)
+				{
+					emit(buffer[r]);
+				}
+			}
+		}, weighted, undirected, threads);
+	}
+private:
+	// Ребро между точками first и second, если они не дальше радиуса.
+	template<typename F>
+	static void Connect(const geometric_data_t& grid, uint64_t first, uint64_t second, F& emit)
+	{
+		double dx = grid.x[first] - grid.x[second];
+		double dy = grid.y[first] - grid.y[second];
+		double distance = std::sqrt(dx * dx + dy * dy);
+
+		if (distance <= grid.radius)
+		{
+			emit(edge_t{ first, second, E(distance) });
+		}
+	}
+
+	static uint64_t Cell(const geometric_data_t& grid, double coordinate)
+	{
+		return std::min((uint64_t)(coordinate * grid.gridSize), grid.gridSize - 1);
+	}
+
+	static uint64_t Mix(uint64_t x)
+	{
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+
+		return x ^ (x >> 31);
+	}
+};
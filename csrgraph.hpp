@@ -0,0 +1,511 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "nutility.hpp"
+
+/*
+	Граф общего вида в формате CSR (compressed sparse row).
+
+	Исходящие рёбра вершины v - это targets[k] (и weights[k], если веса есть) для k от
+	offsets[v] до offsets[v + 1]. Внутри вершины рёбра отсортированы по цели. Значения
+	вершин типа V лежат параллельным массивом.
+
+	Все массивы лежат в одном буфере по смещениям из заголовка, как в NFlatTree, поэтому
+	Save пишет буфер в файл как есть, а Open отображает файл через mmap и сразу читает граф
+	без разбора и без копирования.
+*/
+template<typename V, typename E = float>
+class CsrGraph
+{
+	static_assert(std::is_trivially_copyable_v<V>, "CsrGraph хранит значения побайтово, V должен быть тривиально копируемым");
+	static_assert(std::is_trivially_copyable_v<E>, "CsrGraph хранит веса побайтово, E должен быть тривиально копируемым");
+public:
+	// Номер несуществующей вершины.
+	static constexpr uint64_t INVALID_VERTEX = UINT64_MAX;
+
+	// Ребро для построения. Вес используется, только если граф строится с весами.
+	struct edge_t
+	{
+		uint64_t source;
+		uint64_t target;
+		E weight;
+	};
+
+	// Callback итерации. Смысл возвращаемого значения такой же, как в NLeaf::Walk.
+	using walk_callback_t = std::function<bool(uint64_t)>;
+private:
+	// Заголовок буфера. Все смещения - от начала буфера, weightsOffset равен 0, если весов нет.
+	struct graph_header_t
+	{
+		uint64_t magic;
+		uint64_t valueSize;
+		uint64_t weightSize;
+		uint64_t vertexAmount;
+		uint64_t edgeAmount;
+		uint64_t byteSize;
+
+		uint64_t offsetsOffset;
+		uint64_t targetsOffset;
+		uint64_t weightsOffset;
+		uint64_t valuesOffset;
+	};
+
+	static constexpr uint64_t GRAPH_MAGIC = 0x3168706172677343; // "Csgraph1"
+
+	// Диапазоны меньше этого размера не делятся между потоками.
+	static constexpr size_t PARALLEL_RANGE_SIZE = 65536;
+
+	// Собственный буфер. Пуст, если граф отображён из файла.
+	std::vector<uint64_t> mStorage;
+
+	// Отображение файла из Open.
+	NMapping mMapping;
+
+	const uint8_t* mData = nullptr;
+
+	const graph_header_t* mHeader = nullptr;
+	uint64_t* mOffsets = nullptr;
+	uint64_t* mTargets = nullptr;
+	E* mWeights = nullptr;
+	V* mValues = nullptr;
+public:
+	CsrGraph() = default;
+
+	CsrGraph(const CsrGraph&) = delete;
+	CsrGraph& operator=(const CsrGraph&) = delete;
+
+	CsrGraph(CsrGraph&& other) noexcept
+	{
+		*this = std::move(other);
+	}
+
+	CsrGraph& operator=(CsrGraph&& other) noexcept
+	{
+		const uint8_t* data = other.mData;
+		bool owned = other.mStorage.size() > 0;
+
+		mStorage = std::move(other.mStorage);
+		mMapping = std::move(other.mMapping);
+
+		other.Bind(nullptr);
+
+		Bind(owned ? reinterpret_cast<const uint8_t*>(mStorage.data()) : data);
+
+		return *this;
+	}
+public:
+	/*
+		Построение графа на vertexAmount вершинах из списка рёбер в threads потоков.
+		weighted - хранить ли веса рёбер, undirected - добавить каждому ребру обратное.
+		Если какое-то ребро выходит за пределы вершин, то возвращается пустой граф.
+	*/
+	static CsrGraph<V, E> FromEdges(uint64_t vertexAmount, const std::vector<edge_t>& edges, bool weighted = false, bool undirected = false, uint16_t threads = 1)
+	{
+		return FromGenerator(vertexAmount, edges.size(), [&](uint64_t begin, uint64_t end, auto emit) {
+			for (uint64_t e = begin; e < end; e++)
+			{
+				emit(edges[e]);
+			}
+		}, weighted, undirected, threads);
+	}
+
+	/*
+		Построение графа по источнику рёбер без списка рёбер в памяти. Источник разбит на
+		itemAmount элементов, generate(начало, конец, emit) вызывает emit(edge_t) на каждое ребро
+		элементов [начало, конец) и может выдать на элемент сколько угодно рёбер. Источник
+		читается дважды, для подсчёта и для раскладки, поэтому на одном и том же диапазоне
+		он обязан выдавать одни и те же рёбра независимо от того, как диапазон поделён между потоками.
+		Остальные параметры - как у FromEdges.
+	*/
+	template<typename G>
+	static CsrGraph<V, E> FromGenerator(uint64_t vertexAmount, uint64_t itemAmount, G generate, bool weighted = false, bool undirected = false, uint16_t threads = 1)
+	{
+		CsrGraph<V, E> result;
+
+		// Подсчёт исходящих рёбер каждой вершины.
+		std::vector<uint64_t> counts(vertexAmount, 0);
+		std::atomic<uint64_t> edgeAmount = 0;
+		std::atomic<bool> valid = true;
+
+		NParallel::ForRange(itemAmount, threads, PARALLEL_RANGE_SIZE, [&](size_t begin, size_t end) {
+			uint64_t emitted = 0;
+
+			generate(begin, end, [&](const edge_t& edge) {
+				if (edge.source >= vertexAmount || edge.target >= vertexAmount)
+				{
+					valid = false;
+					return;
+				}
+
+				std::atomic_ref<uint64_t>(counts[edge.source]).fetch_add(1, std::memory_order_relaxed);
+
+				if (undirected)
+				{
+					std::atomic_ref<uint64_t>(counts[edge.target]).fetch_add(1, std::memory_order_relaxed);
+				}
+
+				emitted += undirected ? 2 : 1;
+			});
+
+			edgeAmount += emitted;
+		});
+
+		if (!valid)
+		{
+			return result;
+		}
+
+		result.Allocate(vertexAmount, edgeAmount, weighted);
+
+		// Префиксная сумма в смещения. counts становятся курсорами записи.
+		uint64_t* offsets = result.mOffsets;
+		offsets[0] = 0;
+
+		for (uint64_t v = 0; v < vertexAmount; v++)
+		{
+			offsets[v + 1] = offsets[v] + counts[v];
+			counts[v] = offsets[v];
+		}
+
+		// Раскладка рёбер по местам.
+		NParallel::ForRange(itemAmount, threads, PARALLEL_RANGE_SIZE, [&](size_t begin, size_t end) {
+			generate(begin, end, [&](const edge_t& edge) {
+				uint64_t slot = std::atomic_ref<uint64_t>(counts[edge.source]).fetch_add(1, std::memory_order_relaxed);
+				result.PlaceEdge(slot, edge.target, edge.weight);
+
+				if (undirected)
+				{
+					slot = std::atomic_ref<uint64_t>(counts[edge.target]).fetch_add(1, std::memory_order_relaxed);
+					result.PlaceEdge(slot, edge.source, edge.weight);
+				}
+			});
+		});
+
+		// Порядок рёбер после параллельной раскладки случаен, поэтому сортируем каждую вершину по цели.
+		NParallel::ForRange(vertexAmount, threads, PARALLEL_RANGE_SIZE, [&](size_t begin, size_t end) {
+			std::vector<std::pair<uint64_t, E>> row = {};
+
+			for (size_t v = begin; v < end; v++)
+			{
+				uint64_t* targets = result.mTargets + offsets[v];
+				uint64_t degree = offsets[v + 1] - offsets[v];
+
+				if (!weighted)
+				{
+					std::sort(targets, targets + degree);
+					continue;
+				}
+
+				E* weights = result.mWeights + offsets[v];
+
+				row.resize(degree);
+				for (uint64_t e = 0; e < degree; e++)
+				{
+					row[e] = { targets[e], weights[e] };
+				}
+
+				std::sort(row.begin(), row.end(), [](const std::pair<uint64_t, E>& a, const std::pair<uint64_t, E>& b) -> bool {
+					return a.first < b.first;
+				});
+
+				for (uint64_t e = 0; e < degree; e++)
+				{
+					targets[e] = row[e].first;
+					weights[e] = row[e].second;
+				}
+			}
+		});
+
+		return result;
+	}
+
+	/*
+		Представление поверх готового буфера без копирования. Буфер должен жить дольше графа.
+		Заголовок не сверяется с размером буфера, поэтому буфер должен быть построен этим же классом.
+	*/
+	static CsrGraph<V, E> View(const void* data)
+	{
+		CsrGraph<V, E> result;
+
+		const graph_header_t* header = static_cast<const graph_header_t*>(data);
+		if (header->magic == GRAPH_MAGIC && header->valueSize == sizeof(V) && header->weightSize == sizeof(E))
+		{
+			result.Bind(static_cast<const uint8_t*>(data));
+		}
+
+		return result;
+	}
+
+	/*
+		Представление поверх буфера известного размера byteSize, содержимому которого нельзя доверять
+		(файл, чужая память). Заголовок и все массивы должны лежать внутри буфера, а смещения рёбер -
+		начинаться с 0 и заканчиваться на edgeAmount, иначе возвращается пустой граф.
+	*/
+	static CsrGraph<V, E> View(const void* data, uint64_t byteSize)
+	{
+		if (data == nullptr || byteSize < sizeof(graph_header_t))
+		{
+			return CsrGraph<V, E>();
+		}
+
+		const graph_header_t* header = static_cast<const graph_header_t*>(data);
+		uint64_t size = header->byteSize;
+
+		// Массив из amount элементов по elementSize байт. Сначала деление, чтобы произведение не переполнилось.
+		auto contains = [&](uint64_t offset, uint64_t amount, uint64_t elementSize) -> bool {
+			return amount <= size / elementSize && NBufferLayout::Contains(size, sizeof(graph_header_t), offset, amount * elementSize);
+		};
+
+		bool fits = header->magic == GRAPH_MAGIC && header->valueSize == sizeof(V) && header->weightSize == sizeof(E) &&
+			size <= byteSize && header->vertexAmount < size / sizeof(uint64_t) &&
+			contains(header->offsetsOffset, header->vertexAmount + 1, sizeof(uint64_t)) &&
+			contains(header->targetsOffset, header->edgeAmount, sizeof(uint64_t)) &&
+			(header->weightsOffset == 0 || contains(header->weightsOffset, header->edgeAmount, sizeof(E))) &&
+			contains(header->valuesOffset, header->vertexAmount, sizeof(V));
+
+		if (!fits)
+		{
+			return CsrGraph<V, E>();
+		}
+
+		const uint64_t* offsets = NBufferLayout::At<uint64_t>(static_cast<const uint8_t*>(data), header->offsetsOffset);
+		if (offsets[0] != 0 || offsets[header->vertexAmount] != header->edgeAmount)
+		{
+			return CsrGraph<V, E>();
+		}
+
+		return View(data);
+	}
+
+	// Сохранение буфера в файл как есть.
+	bool Save(const std::string& path) const
+	{
+		std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+		if (!stream.good() || mHeader == nullptr)
+		{
+			return false;
+		}
+
+		stream.write(reinterpret_cast<const char*>(mData), mHeader->byteSize);
+
+		return stream.good();
+	}
+
+	/*
+		Открытие файла из Save через отображение в память только для чтения: страницы
+		подгружаются по мере обращения, граф больше памяти тоже можно открыть.
+	*/
+	static CsrGraph<V, E> Open(const std::string& path)
+	{
+		CsrGraph<V, E> result;
+
+		if (!result.mMapping.OpenFile(path))
+		{
+			return result;
+		}
+
+		// Файлу нельзя доверять: заголовок проверяется так же, как для чужого буфера.
+		if (View(result.mMapping.GetData(), result.mMapping.GetSize()).mHeader == nullptr)
+		{
+			return CsrGraph<V, E>();
+		}
+
+		result.Bind(static_cast<const uint8_t*>(result.mMapping.GetData()));
+
+		return result;
+	}
+public:
+	uint64_t GetVertexAmount() const
+	{
+		return (mHeader != nullptr) ? mHeader->vertexAmount : 0;
+	}
+
+	uint64_t GetEdgeAmount() const
+	{
+		return (mHeader != nullptr) ? mHeader->edgeAmount : 0;
+	}
+
+	bool HasWeights() const
+	{
+		return mWeights != nullptr;
+	}
+
+	// Доступ по вершинам: степень, цель и вес ребра с индексом index среди рёбер вершины.
+
+	uint64_t GetDegree(uint64_t vertex) const
+	{
+		return mOffsets[vertex + 1] - mOffsets[vertex];
+	}
+
+	uint64_t GetTarget(uint64_t vertex, uint64_t index) const
+	{
+		return mTargets[mOffsets[vertex] + index];
+	}
+
+	E GetWeight(uint64_t vertex, uint64_t index) const
+	{
+		return (mWeights != nullptr) ? mWeights[mOffsets[vertex] + index] : E(1);
+	}
+
+	// Значения вершин. Изменять можно только граф в собственном буфере, а не открытый через Open или View.
+
+	V GetValue(uint64_t vertex) const
+	{
+		return mValues[vertex];
+	}
+
+	void SetValue(uint64_t vertex, V value)
+	{
+		mValues[vertex] = value;
+	}
+
+	// Массивы как есть: смещения (vertexAmount + 1), цели, веса (nullptr без весов) и значения.
+
+	const uint64_t* GetOffsets() const
+	{
+		return mOffsets;
+	}
+
+	const uint64_t* GetTargets() const
+	{
+		return mTargets;
+	}
+
+	const E* GetWeights() const
+	{
+		return mWeights;
+	}
+
+	const V* GetValues() const
+	{
+		return mValues;
+	}
+
+	// Буфер целиком, например для передачи в разделяемую память.
+
+	const void* GetData() const
+	{
+		return mData;
+	}
+
+	uint64_t GetByteSize() const
+	{
+		return (mHeader != nullptr) ? mHeader->byteSize : 0;
+	}
+public:
+	/*
+		Итерация в ширину по вершинам, достижимым из from, как NLeaf::Walk: walker вызывается
+		на каждую вершину один раз, возвращённый true прекращает обход.
+	*/
+	void Walk(walk_callback_t walker, uint64_t from = 0) const
+	{
+		if (from >= GetVertexAmount())
+		{
+			return;
+		}
+
+		std::vector<uint8_t> visited(GetVertexAmount(), 0);
+		std::vector<uint64_t> collected = { from };
+
+		visited[from] = 1;
+
+		for (size_t c = 0; c < collected.size(); c++)
+		{
+			uint64_t vertex = collected[c];
+
+			for (uint64_t e = mOffsets[vertex]; e < mOffsets[vertex + 1]; e++)
+			{
+				if (visited[mTargets[e]] == 0)
+				{
+					visited[mTargets[e]] = 1;
+					collected.push_back(mTargets[e]);
+				}
+			}
+
+			if (walker(vertex))
+			{
+				break;
+			}
+		}
+	}
+
+	// Вызов visit(цель, вес) на каждое исходящее ребро вершины.
+	template<typename F>
+	void ForEachEdge(uint64_t vertex, F visit) const
+	{
+		for (uint64_t e = mOffsets[vertex]; e < mOffsets[vertex + 1]; e++)
+		{
+			visit(mTargets[e], (mWeights != nullptr) ? mWeights[e] : E(1));
+		}
+	}
+private:
+	void PlaceEdge(uint64_t slot, uint64_t target, E weight)
+	{
+		mTargets[slot] = target;
+
+		if (mWeights != nullptr)
+		{
+			mWeights[slot] = weight;
+		}
+	}
+
+	// Выделение собственного буфера и раскладка массивов в нём.
+	void Allocate(uint64_t vertexAmount, uint64_t edgeAmount, bool weighted)
+	{
+		graph_header_t header = {};
+		header.magic = GRAPH_MAGIC;
+		header.valueSize = sizeof(V);
+		header.weightSize = sizeof(E);
+		header.vertexAmount = vertexAmount;
+		header.edgeAmount = edgeAmount;
+
+		NBufferLayout layout(sizeof(graph_header_t));
+		header.offsetsOffset = layout.Add((vertexAmount + 1) * sizeof(uint64_t));
+		header.targetsOffset = layout.Add(edgeAmount * sizeof(uint64_t));
+
+		if (weighted)
+		{
+			header.weightsOffset = layout.Add(edgeAmount * sizeof(E));
+		}
+
+		header.valuesOffset = layout.Add(vertexAmount * sizeof(V));
+		header.byteSize = layout.GetSize();
+
+		mStorage = layout.Allocate(header);
+
+		Bind(reinterpret_cast<const uint8_t*>(mStorage.data()));
+	}
+
+	// Настройка указателей на массивы по заголовку буфера.
+	void Bind(const uint8_t* data)
+	{
+		mData = data;
+
+		if (data == nullptr)
+		{
+			mHeader = nullptr;
+			mOffsets = nullptr;
+			mTargets = nullptr;
+			mWeights = nullptr;
+			mValues = nullptr;
+
+			return;
+		}
+
+		mHeader = reinterpret_cast<const graph_header_t*>(data);
+		mOffsets = NBufferLayout::At<uint64_t>(data, mHeader->offsetsOffset);
+		mTargets = NBufferLayout::At<uint64_t>(data, mHeader->targetsOffset);
+		mWeights = (mHeader->weightsOffset != 0) ? NBufferLayout::At<E>(data, mHeader->weightsOffset) : nullptr;
+		mValues = NBufferLayout::At<V>(data, mHeader->valuesOffset);
+	}
+};
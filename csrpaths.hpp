@@ -0,0 +1,160 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "csrgraph.hpp"
+#include "nbuild.hpp"
+#include "nheap.hpp"
+
+/*
+	Кратчайшие пути (Дейкстра) и минимальное остовное дерево (Прим) на CsrGraph поверх
+	d-арной кучи NHeap с арностью D.
+
+	Оба алгоритма возвращают массив родителей: parents[source] = source, у недостижимых вершин
+	INVALID_VERTEX. ShortestPathTree и MinimumSpanningTree собирают из него NTree через NBuilder.
+	У графа без весов вес каждого ребра равен 1. Веса должны быть неотрицательными, а для
+	минимального остовного дерева граф должен хранить каждое ребро в обе стороны (undirected).
+*/
+template<typename V, typename E = float>
+class CsrPaths
+{
+public:
+	static constexpr uint64_t INVALID_VERTEX = CsrGraph<V, E>::INVALID_VERTEX;
+public:
+	/*
+		Кратчайшие пути из source. Если передан distances, то в него пишутся расстояния,
+		у недостижимых вершин - std::numeric_limits<E>::max().
+	*/
+	template<uint16_t D = 4>
+	static std::vector<uint64_t> Dijkstra(const CsrGraph<V, E>& graph, uint64_t source, std::vector<E>* distances = nullptr)
+	{
+		return Grow<D>(graph, source, distances, true);
+	}
+
+	/*
+		Минимальное остовное дерево компоненты source. Если передан weights, то в него пишется
+		вес ребра до родителя каждой вершины в дереве (у source и недостижимых вершин - 0).
+	*/
+	template<uint16_t D = 4>
+	static std::vector<uint64_t> Prim(const CsrGraph<V, E>& graph, uint64_t source, std::vector<E>* weights = nullptr)
+	{
+		return Grow<D>(graph, source, weights, false);
+	}
+
+	/*
+		Дерево кратчайших путей из source в виде NTree со значениями вершин, только по
+		достижимым вершинам. Потомки каждого лепестка идут по возрастанию номеров вершин.
+		Возвращает nullptr, если у какой-то вершины в дереве больше N детей.
+	*/
+	template<uint16_t N, uint16_t D = 4>
+	static NLeaf<V, N>* ShortestPathTree(const CsrGraph<V, E>& graph, uint64_t source, NArena<V, N>* arena = nullptr)
+	{
+		return BuildTree<N>(graph, Dijkstra<D>(graph, source), arena);
+	}
+
+	// Минимальное остовное дерево компоненты source в виде NTree, так же как ShortestPathTree.
+	template<uint16_t N, uint16_t D = 4>
+	static NLeaf<V, N>* MinimumSpanningTree(const CsrGraph<V, E>& graph, uint64_t source, NArena<V, N>* arena = nullptr)
+	{
+		return BuildTree<N>(graph, Prim<D>(graph, source), arena);
+	}
+private:
+	/*
+		Общий рост дерева из source. Приоритет вершины вне дерева - расстояние до source через
+		уже извлечённые вершины (shortestPaths) или вес самого лёгкого ребра в дерево (Прим).
+		В keys пишутся итоговые приоритеты.
+	*/
+	template<uint16_t D>
+	static std::vector<uint64_t> Grow(const CsrGraph<V, E>& graph, uint64_t source, std::vector<E>* keys, bool shortestPaths)
+	{
+		uint64_t vertexAmount = graph.GetVertexAmount();
+
+		std::vector<uint64_t> parents(vertexAmount, INVALID_VERTEX);
+		std::vector<E> priorities(vertexAmount, std::numeric_limits<E>::max());
+
+		// Извлечённые вершины: их приоритет окончательный.
+		std::vector<bool> done(vertexAmount, false);
+
+		if (source < vertexAmount)
+		{
+			NHeap<E, D> heap(vertexAmount);
+
+			parents[source] = source;
+			priorities[source] = E(0);
+			heap.Push(source, E(0));
+
+			while (!heap.IsEmpty())
+			{
+				uint64_t vertex = heap.Pop();
+				done[vertex] = true;
+
+				graph.ForEachEdge(vertex, [&](uint64_t target, E weight) {
+					if (done[target])
+					{
+						return;
+					}
+
+					E priority = shortestPaths ? priorities[vertex] + weight : weight;
+
+					if (priority < priorities[target])
+					{
+						priorities[target] = priority;
+						parents[target] = vertex;
+
+						heap.Update(target, priority);
+					}
+				});
+			}
+		}
+
+		if (keys != nullptr)
+		{
+			// У Прима приоритет вершины - вес ребра до родителя, у source и недостижимых вершин его нет.
+			if (!shortestPaths)
+			{
+				for (uint64_t vertex = 0; vertex < vertexAmount; vertex++)
+				{
+					if (parents[vertex] == INVALID_VERTEX || vertex == source)
+					{
+						priorities[vertex] = E(0);
+					}
+				}
+			}
+
+			keys->swap(priorities);
+		}
+
+		return parents;
+	}
+
+	// Сборка NTree по массиву родителей: недостижимые вершины выбрасываются, остальные перенумеровываются подряд.
+	template<uint16_t N>
+	static NLeaf<V, N>* BuildTree(const CsrGraph<V, E>& graph, const std::vector<uint64_t>& parents, NArena<V, N>* arena)
+	{
+		std::vector<uint64_t> numbers(parents.size(), INVALID_VERTEX);
+		std::vector<V> values = {};
+
+		for (uint64_t vertex = 0; vertex < parents.size(); vertex++)
+		{
+			if (parents[vertex] != INVALID_VERTEX)
+			{
+				numbers[vertex] = values.size();
+				values.push_back(graph.GetValue(vertex));
+			}
+		}
+
+		std::vector<uint64_t> treeParents(values.size());
+
+		for (uint64_t vertex = 0; vertex < parents.size(); vertex++)
+		{
+			if (parents[vertex] != INVALID_VERTEX)
+			{
+				treeParents[numbers[vertex]] = (parents[vertex] == vertex) ? NBuilder<V, N>::INVALID_LEAF : numbers[parents[vertex]];
+			}
+		}
+
+		return NBuilder<V, N>::FromParents(treeParents, values, arena);
+	}
+};
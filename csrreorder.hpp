@@ -0,0 +1,312 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "csrgraph.hpp"
+#include "ncsr.hpp"
+
+/*
+	Перенумерация вершин графа и лепестков дерева для локальности в памяти.
+
+	Вершины, которые обходятся вместе, должны лежать рядом, иначе каждый переход по ребру
+	промахивается мимо кэша. Порядки:
+	- DegreeSort: по убыванию степени, частые цели (хабы) собираются в начале;
+	- ReverseCuthillMcKee: обход в ширину с соседями по возрастанию степени, развёрнутый, -
+	  уменьшает ширину ленты, номера соседей оказываются близкими;
+	- Gorder: жадная расстановка, где следующей ставится вершина с наибольшим числом связей
+	  (общих соседей и прямых рёбер) с последними WINDOW поставленными.
+
+	Все порядки возвращают перестановку: permutation[v] - новый номер вершины v. Она применяется
+	к CsrGraph и к CSR-дереву через Apply. Порядки считаются по исходящим рёбрам, поэтому для
+	ориентированного графа лучше передавать граф, построенный с undirected.
+*/
+template<typename V, typename E = float>
+class CsrReorder
+{
+private:
+	// Сколько последних поставленных вершин учитывает Gorder.
+	static constexpr uint64_t WINDOW = 5;
+
+	// Через вершины с большей степенью Gorder не считает общих соседей: их слишком много и они мало что дают.
+	static constexpr uint64_t HUB_DEGREE = 256;
+public:
+	// Порядок по убыванию степени. Вершины с равной степенью сохраняют исходный порядок.
+	static std::vector<uint64_t> DegreeSort(const CsrGraph<V, E>& graph)
+	{
+		return ToPermutation(ByDegree(graph, true));
+	}
+
+	// Обратный порядок Катхилла-Макки. Каждая компонента начинается с вершины наименьшей степени.
+	static std::vector<uint64_t> ReverseCuthillMcKee(const CsrGraph<V, E>& graph)
+	{
+		uint64_t vertexAmount = graph.GetVertexAmount();
+
+		std::vector<uint64_t> order = {};
+		order.reserve(vertexAmount);
+
+		std::vector<bool> visited(vertexAmount, false);
+		std::vector<uint64_t> neighbors = {};
+
+		for (uint64_t start : ByDegree(graph, false))
+		{
+			if (visited[start])
+			{
+				continue;
+			}
+
+			visited[start] = true;
+			order.push_back(start);
+
+			for (uint64_t p = order.size() - 1; p < order.size(); p++)
+			{
+				neighbors.clear();
+
+				graph.ForEachEdge(order[p], [&](uint64_t target, E) {
+					if (!visited[target])
+					{
+						visited[target] = true;
+						neighbors.push_back(target);
+					}
+				});
+
+				std::stable_sort(neighbors.begin(), neighbors.end(), [&](uint64_t first, uint64_t second) {
+					return graph.GetDegree(first) < graph.GetDegree(second);
+				});
+
+				order.insert(order.end(), neighbors.begin(), neighbors.end());
+			}
+		}
+
+		std::reverse(order.begin(), order.end());
+
+		return ToPermutation(order);
+	}
+
+	/*
+		Упрощённый Gorder. Очки вершины - количество связей с окном из WINDOW последних поставленных:
+		+1 за каждое ребро к вершине окна и +1 за каждого общего с ней соседа. Когда вершина
+		входит в окно, очки её соседей и соседей её соседей растут, когда выходит - падают.
+		Следующей ставится вершина с наибольшими очками, а если связанных с окном нет, то
+		непоставленная вершина с наибольшей степенью.
+	*/
+	static std::vector<uint64_t> Gorder(const CsrGraph<V, E>& graph)
+	{
+		uint64_t vertexAmount = graph.GetVertexAmount();
+
+		std::vector<uint64_t> order = {};
+		order.reserve(vertexAmount);
+
+		std::vector<bool> placed(vertexAmount, false);
+		std::vector<uint64_t> scores(vertexAmount, 0);
+
+		// Куча (очки, вершина) с ленивым удалением: запись верна, только если очки совпадают с текущими.
+		std::priority_queue<std::pair<uint64_t, uint64_t>> candidates = {};
+
+		std::vector<uint64_t> byDegree = ByDegree(graph, true);
+		uint64_t fallback = 0;
+
+		// Изменение очков всех вершин, связанных с vertex, на delta.
+		auto update = [&](uint64_t vertex, int delta) {
+			auto touch = [&](uint64_t target) {
+				if (placed[target])
+				{
+					return;
+				}
+
+				scores[target] += delta;
+
+				if (delta > 0)
+				{
+					candidates.push({ scores[target], target });
+				}
+			};
+
+			graph.ForEachEdge(vertex, [&](uint64_t neighbor, E) {
+				touch(neighbor);
+
+				if (graph.GetDegree(neighbor) <= HUB_DEGREE)
+				{
+					graph.ForEachEdge(neighbor, [&](uint64_t sibling, E) {
+						if (sibling != vertex)
+						{
+							touch(sibling);
+						}
+					});
+				}
+			});
+		};
+
+		while (order.size() < vertexAmount)
+		{
+			uint64_t next = CsrGraph<V, E>::INVALID_VERTEX;
+
+			while (candidates.size() > 0)
+			{
+				auto [score, vertex] = candidates.top();
+				candidates.pop();
+
+				if (placed[vertex] || score < scores[vertex])
+				{
+					continue;
+				}
+
+				// Очки упали, пока запись лежала в куче: она возвращается с текущими очками.
+				if (score > scores[vertex])
+				{
+					if (scores[vertex] > 0)
+					{
+						candidates.push({ scores[vertex], vertex });
+					}
+
+					continue;
+				}
+
+				next = vertex;
+				break;
+			}
+
+			if (next == CsrGraph<V, E>::INVALID_VERTEX)
+			{
+				while (placed[byDegree[fallback]])
+				{
+					fallback++;
+				}
+
+				next = byDegree[fallback];
+			}
+
+			placed[next] = true;
+			order.push_back(next);
+
+			update(next, 1);
+
+			if (order.size() > WINDOW)
+			{
+				update(order[order.size() - 1 - WINDOW], -1);
+			}
+		}
+
+		return ToPermutation(order);
+	}
+public:
+	// Обратная перестановка: inverse[новый номер] = старый номер.
+	static std::vector<uint64_t> Invert(const std::vector<uint64_t>& permutation)
+	{
+		std::vector<uint64_t> inverse(permutation.size());
+
+		for (uint64_t vertex = 0; vertex < permutation.size(); vertex++)
+		{
+			inverse[permutation[vertex]] = vertex;
+		}
+
+		return inverse;
+	}
+
+	// Граф с перенумерованными вершинами: вершина v становится permutation[v] вместе со значением и рёбрами.
+	static CsrGraph<V, E> Apply(const CsrGraph<V, E>& graph, const std::vector<uint64_t>& permutation, uint16_t threads = 1)
+	{
+		std::vector<typename CsrGraph<V, E>::edge_t> edges = {};
+		edges.reserve(graph.GetEdgeAmount());
+
+		for (uint64_t vertex = 0; vertex < graph.GetVertexAmount(); vertex++)
+		{
+			graph.ForEachEdge(vertex, [&](uint64_t target, E weight) {
+				edges.push_back({ permutation[vertex], permutation[target], weight });
+			});
+		}
+
+		CsrGraph<V, E> result = CsrGraph<V, E>::FromEdges(graph.GetVertexAmount(), edges, graph.HasWeights(), false, threads);
+
+		for (uint64_t vertex = 0; vertex < graph.GetVertexAmount(); vertex++)
+		{
+			result.SetValue(permutation[vertex], graph.GetValue(vertex));
+		}
+
+		return result;
+	}
+
+	/*
+		CSR-дерево с перенумерованными лепестками, цели всегда явные. Порядок потомков каждого
+		лепестка сохраняется, корнем становится лепесток permutation[0].
+	*/
+	static NCsrTree<V> Apply(const NCsrView<V>& tree, const std::vector<uint64_t>& permutation)
+	{
+		std::vector<uint64_t> inverse = Invert(permutation);
+
+		NCsrTree<V> result;
+		std::vector<uint64_t>& offsets = result.GetOffsets();
+		std::vector<uint64_t>& targets = result.GetTargets();
+		std::vector<V>& values = result.GetValues();
+
+		offsets.reserve(tree.GetLeafAmount() + 1);
+		targets.reserve(tree.GetEdgeAmount());
+		values.reserve(tree.GetLeafAmount());
+
+		offsets.push_back(0);
+
+		for (uint64_t leaf = 0; leaf < tree.GetLeafAmount(); leaf++)
+		{
+			uint64_t old = inverse[leaf];
+
+			for (uint64_t edge = tree.GetOffsets()[old]; edge < tree.GetOffsets()[old + 1]; edge++)
+			{
+				targets.push_back(permutation[tree.GetTarget(edge)]);
+			}
+
+			offsets.push_back(targets.size());
+			values.push_back(tree.GetValue(old));
+		}
+
+		return result;
+	}
+
+	// Граф из CSR-дерева с рёбрами в обе стороны, чтобы посчитать для лепестков любой из порядков выше.
+	static CsrGraph<V, E> FromTree(const NCsrView<V>& tree)
+	{
+		std::vector<typename CsrGraph<V, E>::edge_t> edges = {};
+		edges.reserve(tree.GetEdgeAmount());
+
+		for (uint64_t leaf = 0; leaf < tree.GetLeafAmount(); leaf++)
+		{
+			for (uint64_t edge = tree.GetOffsets()[leaf]; edge < tree.GetOffsets()[leaf + 1]; edge++)
+			{
+				edges.push_back({ leaf, tree.GetTarget(edge), E(1) });
+			}
+		}
+
+		CsrGraph<V, E> result = CsrGraph<V, E>::FromEdges(tree.GetLeafAmount(), edges, false, true);
+
+		for (uint64_t leaf = 0; leaf < tree.GetLeafAmount(); leaf++)
+		{
+			result.SetValue(leaf, tree.GetValue(leaf));
+		}
+
+		return result;
+	}
+private:
+	// Вершины по степени (по убыванию или возрастанию), с равной степенью - по номеру.
+	static std::vector<uint64_t> ByDegree(const CsrGraph<V, E>& graph, bool descending)
+	{
+		std::vector<uint64_t> order(graph.GetVertexAmount());
+		for (uint64_t vertex = 0; vertex < order.size(); vertex++)
+		{
+			order[vertex] = vertex;
+		}
+
+		std::stable_sort(order.begin(), order.end(), [&](uint64_t first, uint64_t second) {
+			return descending ? graph.GetDegree(first) > graph.GetDegree(second) : graph.GetDegree(first) < graph.GetDegree(second);
+		});
+
+		return order;
+	}
+
+	// Перестановка по порядку: вершина order[k] получает номер k.
+	static std::vector<uint64_t> ToPermutation(const std::vector<uint64_t>& order)
+	{
+		return Invert(order);
+	}
+};
@@ -0,0 +1,292 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/*
+	Эпохальная (epoch-based) сборка удалённых лепестков.
+
+	Читатели оборачивают работу с деревом (Walk, GetNChild, поиск) в EpochDomain::ReadGuard.
+	Писатель заменяет или отсоединяет поддеревья через NLeaf::ReplaceNChild и отдаёт старые
+	поддеревья в Retire вместо delete. Поддерево удаляется только тогда, когда ни один читатель,
+	вошедший до его отсоединения, уже не может его видеть.
+*/
+class EpochDomain
+{
+public:
+	/*
+		Количество собственных слотов читателей. Вложенный ReadGuard занимает ещё один слот.
+		Читатели сверх этого числа не ждут, а входят через общий запасной слот: он медленнее
+		(защищён мьютексом) и держит самую старую эпоху, пока из него не выйдут все.
+	*/
+	static constexpr size_t MAX_READERS = 64;
+
+	// Через сколько вызовов Retire автоматически пробовать освободить память.
+	static constexpr size_t RECLAIM_THRESHOLD = 64;
+
+	// Эпоха слота, который сейчас не занят читателем.
+	static constexpr uint64_t INACTIVE_EPOCH = UINT64_MAX;
+
+	/*
+		Охранник чтения. Пока он существует, все лепестки, которые читатель получил
+		из дерева, не будут удалены, даже если писатель их уже отсоединил.
+	*/
+	class ReadGuard
+	{
+	private:
+		EpochDomain* mDomain;
+		size_t mSlot;
+	public:
+		ReadGuard(EpochDomain& domain)
+		{
+			mDomain = &domain;
+			mSlot = domain.Enter();
+		}
+
+		~ReadGuard()
+		{
+			mDomain->Leave(mSlot);
+		}
+
+		ReadGuard(const ReadGuard&) = delete;
+		ReadGuard& operator=(const ReadGuard&) = delete;
+	};
+private:
+	// Слот читателя. Выровнен по кэш-линии, чтобы читатели не мешали друг другу.
+	struct alignas(64) reader_slot_t
+	{
+		std::atomic<uint64_t> epoch = INACTIVE_EPOCH;
+		std::atomic<bool> used = false;
+	};
+
+	// Отложенный на удаление объект и эпоха, в которую он был отсоединён.
+	struct retired_t
+	{
+		uint64_t epoch;
+		void* pointer;
+		void (*deleter)(void*);
+	};
+
+	// Текущая глобальная эпоха.
+	std::atomic<uint64_t> mGlobalEpoch = 0;
+
+	reader_slot_t mSlots[MAX_READERS];
+
+	// Номер запасного слота, который возвращает Enter, когда собственные слоты заняты.
+	static constexpr size_t OVERFLOW_SLOT = MAX_READERS;
+
+	// Запасной слот: самая старая эпоха его читателей и их количество.
+	reader_slot_t mOverflowSlot;
+	std::mutex mOverflowMutex;
+	size_t mOverflowReaders = 0;
+
+	// Отложенные объекты. Защищены мьютексом, так как Retire вызывается редко по сравнению с чтением.
+	std::mutex mRetiredMutex;
+	std::vector<retired_t> mRetired;
+public:
+	EpochDomain() = default;
+
+	// Уничтожение домена. К этому моменту читателей быть уже не должно, поэтому удаляем всё.
+	~EpochDomain()
+	{
+		for (const retired_t& retired : mRetired)
+		{
+			retired.deleter(retired.pointer);
+		}
+	}
+
+	EpochDomain(const EpochDomain&) = delete;
+	EpochDomain& operator=(const EpochDomain&) = delete;
+public:
+	/*
+		Отложенное удаление объекта, который уже недоступен из дерева.
+		Для лепестка вызывается delete, который удалит и всё его поддерево.
+	*/
+	template<typename P>
+	void Retire(P* pointer)
+	{
+		if (pointer == nullptr)
+		{
+			return;
+		}
+
+		size_t retiredAmount = 0;
+
+		{
+			std::lock_guard<std::mutex> lock(mRetiredMutex);
+
+			mRetired.push_back({ mGlobalEpoch.load(std::memory_order_seq_cst), pointer, [](void* p) {
+				delete static_cast<P*>(p);
+			} });
+
+			retiredAmount = mRetired.size();
+		}
+
+		if (retiredAmount >= RECLAIM_THRESHOLD)
+		{
+			Reclaim();
+		}
+	}
+
+	/*
+		Продвигает глобальную эпоху и удаляет все объекты, отсоединённые раньше,
+		чем самый старый из активных читателей вошёл в свою эпоху.
+
+		Возвращает количество удалённых объектов.
+	*/
+	size_t Reclaim()
+	{
+		mGlobalEpoch.fetch_add(1, std::memory_order_seq_cst);
+
+		// Находим самую старую эпоху среди активных читателей.
+		uint64_t minEpoch = mGlobalEpoch.load(std::memory_order_seq_cst);
+
+		for (size_t s = 0; s < MAX_READERS; s++)
+		{
+			uint64_t epoch = mSlots[s].epoch.load(std::memory_order_seq_cst);
+
+			if (epoch < minEpoch)
+			{
+				minEpoch = epoch;
+			}
+		}
+
+		minEpoch = std::min(minEpoch, mOverflowSlot.epoch.load(std::memory_order_seq_cst));
+
+		// Забираем то, что можно удалить, и удаляем уже без блокировки.
+		std::vector<retired_t> toDelete = {};
+
+		{
+			std::lock_guard<std::mutex> lock(mRetiredMutex);
+
+			auto boundary = std::partition(mRetired.begin(), mRetired.end(), [&](const retired_t& retired) -> bool {
+				return retired.epoch >= minEpoch;
+			});
+
+			toDelete.assign(boundary, mRetired.end());
+			mRetired.erase(boundary, mRetired.end());
+		}
+
+		for (const retired_t& retired : toDelete)
+		{
+			retired.deleter(retired.pointer);
+		}
+
+		return toDelete.size();
+	}
+
+	// Количество объектов, ожидающих удаления.
+	size_t GetRetiredAmount()
+	{
+		std::lock_guard<std::mutex> lock(mRetiredMutex);
+
+		return mRetired.size();
+	}
+private:
+	/*
+		Вход читателя: занимаем свободный слот и объявляем в нём текущую эпоху.
+		Эпоха перечитывается, пока объявленная не совпадёт с глобальной, иначе писатель
+		мог бы продвинуть эпоху между чтением и объявлением и не заметить нас.
+		Если за один проход свободного слота нет, то читатель входит через запасной слот.
+	*/
+	size_t Enter()
+	{
+		// Подсказка, с какого слота начинать поиск, чтобы поток обычно сразу попадал в свой слот.
+		thread_local size_t hint = 0;
+
+		size_t slot = hint;
+		bool entered = false;
+
+		for (size_t attempt = 0; attempt < MAX_READERS && !entered; attempt++)
+		{
+			bool expected = false;
+			entered = mSlots[slot].used.compare_exchange_strong(expected, true, std::memory_order_acquire);
+
+			if (!entered)
+			{
+				slot = (slot + 1) % MAX_READERS;
+			}
+		}
+
+		if (!entered)
+		{
+			return EnterOverflow();
+		}
+
+		hint = slot;
+
+		uint64_t epoch = mGlobalEpoch.load(std::memory_order_seq_cst);
+
+		while (true)
+		{
+			mSlots[slot].epoch.store(epoch, std::memory_order_seq_cst);
+
+			uint64_t current = mGlobalEpoch.load(std::memory_order_seq_cst);
+			if (current == epoch)
+			{
+				break;
+			}
+
+			epoch = current;
+		}
+
+		return slot;
+	}
+
+	// Выход читателя: слот снова неактивен и свободен.
+	void Leave(size_t slot)
+	{
+		if (slot == OVERFLOW_SLOT)
+		{
+			LeaveOverflow();
+
+			return;
+		}
+
+		mSlots[slot].epoch.store(INACTIVE_EPOCH, std::memory_order_release);
+		mSlots[slot].used.store(false, std::memory_order_release);
+	}
+
+	/*
+		Вход через запасной слот. Эпоха слота только уменьшается, пока в нём есть читатели,
+		поэтому объявленная эпоха не новее эпохи любого из них.
+	*/
+	size_t EnterOverflow()
+	{
+		std::lock_guard<std::mutex> lock(mOverflowMutex);
+
+		mOverflowReaders++;
+
+		uint64_t epoch = mGlobalEpoch.load(std::memory_order_seq_cst);
+
+		while (true)
+		{
+			uint64_t announced = std::min(mOverflowSlot.epoch.load(std::memory_order_seq_cst), epoch);
+			mOverflowSlot.epoch.store(announced, std::memory_order_seq_cst);
+
+			uint64_t current = mGlobalEpoch.load(std::memory_order_seq_cst);
+			if (current == epoch)
+			{
+				break;
+			}
+
+			epoch = current;
+		}
+
+		return OVERFLOW_SLOT;
+	}
+
+	// Выход из запасного слота. Последний вышедший делает слот неактивным.
+	void LeaveOverflow()
+	{
+		std::lock_guard<std::mutex> lock(mOverflowMutex);
+
+		if (--mOverflowReaders == 0)
+		{
+			mOverflowSlot.epoch.store(INACTIVE_EPOCH, std::memory_order_release);
+		}
+	}
+};
@@ -3,9 +3,16 @@
 #include <iostream>
 #include <cstdlib>
 
+#include <algorithm>
 #include <fstream>
+#include <random>
+#include <vector>
 
 #include "ntree.hpp"
+#include "narena.hpp"
+#include "csrbfs.hpp"
+#include "csrcomponents.hpp"
+#include "csrreorder.hpp"
 
 // Генерирует N дерево. maxLeaves - максимальное количество элементов.
 NTree<int, 5>* GenerateTree(int maxLeaves)
@@ -59,6 +66,228 @@ NTree<int, 5>* GenerateTree(int maxLeaves)
 	return result;
 }
 
+/*
+	Сравнение раскладок дерева в памяти. Одни и те же запросы по пути от корня до листа
+	и обходы поддеревьев выполняются на исходном дереве (порядок выделения) и на его копиях,
+	переложенных в порядке BFS, DFS и ван Эмде Боаса.
+*/
+void BenchmarkLayouts(NTree<int, 5>* tree)
+{
+	const int pathAmount = 100000;
+	const int scanAmount = 200;
+	const size_t scanDepth = 3;
+
+	// Пути выбираются один раз случайным спуском, чтобы во всех раскладках они были одинаковыми.
+	std::vector<std::vector<uint16_t>> paths = {};
+
+	for (int p = 0; p < pathAmount; p++)
+	{
+		std::vector<uint16_t> path = {};
+		NTree<int, 5>* leaf = tree;
+
+		while (leaf->GetChildAmount() > 0)
+		{
+			uint16_t c = rand() % leaf->GetChildAmount();
+
+			path.push_back(c);
+			leaf = *leaf->GetNChild(c);
+		}
+
+		paths.push_back(path);
+	}
+
+	NArena<int, 5> bfsArena, dfsArena, vebArena;
+
+	std::pair<const char*, NTree<int, 5>*> layouts[] = {
+		{ "allocation", tree },
+		{ "BFS", bfsArena.Relayout(tree, LAYOUT_BFS) },
+		{ "DFS", dfsArena.Relayout(tree, LAYOUT_DFS) },
+		{ "vEB", vebArena.Relayout(tree, LAYOUT_VEB) }
+	};
+
+	for (const auto& [name, root] : layouts)
+	{
+		long long checksum = 0;
+
+		// Запросы по пути: спуск от корня до листа с суммированием значений.
+		profile::StartTimeProfiling();
+
+		for (const std::vector<uint16_t>& path : paths)
+		{
+			NTree<int, 5>* leaf = root;
+			checksum += leaf->GetValue();
+
+			for (uint16_t c : path)
+			{
+				leaf = *leaf->GetNChild(c);
+				checksum += leaf->GetValue();
+			}
+		}
+
+		profile::EndTimeProfiling();
+
+		std::cout << "4. " << pathAmount << " path queries (" << name << " layout) took " << profile::GetProfiledTime().count() << " microseconds." << std::endl;
+
+		// Обходы поддеревьев с корнями на глубине scanDepth.
+		profile::StartTimeProfiling();
+
+		for (int s = 0; s < scanAmount; s++)
+		{
+			const std::vector<uint16_t>& path = paths[s];
+			NTree<int, 5>* subtree = root;
+
+			for (size_t c = 0; c < path.size() && c < scanDepth; c++)
+			{
+				subtree = *subtree->GetNChild(path[c]);
+			}
+
+			subtree->Walk([&](NTree<int, 5>* leaf) -> bool {
+				checksum += leaf->GetValue();
+
+				return false;
+			});
+		}
+
+		profile::EndTimeProfiling();
+
+		std::cout << "\t " << scanAmount << " subtree scans took " << profile::GetProfiledTime().count() << " microseconds (checksum " << checksum << ")" << std::endl << std::endl;
+	}
+}
+
+/*
+	Сравнение порядков нумерации. Дерево выгружается в CSR и как граф, номера перемешиваются
+	(так обычно выглядит то, что приходит извне), после чего обход в ширину по графу, проход по
+	соседям всех вершин и обход дерева в глубину выполняются в перемешанном порядке и после
+	перенумерации DegreeSort, RCM и Gorder.
+*/
+void BenchmarkReordering(NTree<int, 5>* tree)
+{
+	NCsrTree<int> csrTree = NCsrTree<int>::FromTree(tree);
+	CsrGraph<int> treeGraph = CsrReorder<int>::FromTree(csrTree.GetView());
+
+	std::vector<uint64_t> shuffled(treeGraph.GetVertexAmount());
+	for (uint64_t v = 0; v < shuffled.size(); v++)
+	{
+		shuffled[v] = v;
+	}
+
+	std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937_64(rand()));
+
+	CsrGraph<int> inputGraph = CsrReorder<int>::Apply(treeGraph, shuffled);
+	NCsrTree<int> inputTree = CsrReorder<int>::Apply(csrTree.GetView(), shuffled);
+
+	std::vector<uint64_t> identity(shuffled.size());
+	for (uint64_t v = 0; v < identity.size(); v++)
+	{
+		identity[v] = v;
+	}
+
+	std::pair<const char*, std::vector<uint64_t>> orders[] = {
+		{ "input", identity },
+		{ "degree", CsrReorder<int>::DegreeSort(inputGraph) },
+		{ "RCM", CsrReorder<int>::ReverseCuthillMcKee(inputGraph) },
+		{ "Gorder", CsrReorder<int>::Gorder(inputGraph) }
+	};
+
+	for (const auto& [name, permutation] : orders)
+	{
+		CsrGraph<int> graph = CsrReorder<int>::Apply(inputGraph, permutation);
+		NCsrTree<int> orderedTree = CsrReorder<int>::Apply(inputTree.GetView(), permutation);
+		NCsrView<int> view = orderedTree.GetView();
+
+		uint64_t root = permutation[shuffled[0]];
+		long long checksum = 0;
+
+		// Обход в ширину по графу.
+		profile::StartTimeProfiling();
+
+		std::vector<uint64_t> parents = CsrBfs<int>::Run(graph, root);
+
+		profile::EndTimeProfiling();
+
+		std::cout << "5. BFS (" << name << " order) took " << profile::GetProfiledTime().count() << " microseconds." << std::endl;
+
+		// Проход по соседям всех вершин: сумма значений соседей.
+		profile::StartTimeProfiling();
+
+		for (uint64_t v = 0; v < graph.GetVertexAmount(); v++)
+		{
+			graph.ForEachEdge(v, [&](uint64_t target, float) {
+				checksum += graph.GetValue(target);
+			});
+		}
+
+		profile::EndTimeProfiling();
+
+		std::cout << "\t neighbour sweep took " << profile::GetProfiledTime().count() << " microseconds." << std::endl;
+
+		// Обход дерева в глубину от корня по явным целям.
+		profile::StartTimeProfiling();
+
+		std::vector<uint64_t> toVisit = { root };
+		while (toVisit.size() > 0)
+		{
+			uint64_t leaf = toVisit.back();
+			toVisit.pop_back();
+
+			checksum += view.GetValue(leaf);
+
+			for (uint64_t edge = view.GetOffsets()[leaf]; edge < view.GetOffsets()[leaf + 1]; edge++)
+			{
+				toVisit.push_back(view.GetTarget(edge));
+			}
+		}
+
+		profile::EndTimeProfiling();
+
+		std::cout << "\t tree DFS took " << profile::GetProfiledTime().count() << " microseconds (checksum " << checksum << ", " << parents.size() << " vertices)" << std::endl << std::endl;
+	}
+}
+
+/*
+	Проверка леса компонент на широком дереве: звезда с центром больше чем на 65535 лучей
+	и отдельная цепочка. Плоское дерево звезды должно сохранить всех детей центра, а NTree
+	для неё построить нельзя, и на её месте в Forest стоит nullptr.
+*/
+void CheckWideForest()
+{
+	const uint64_t rayAmount = 70000;
+	const uint64_t pathLength = 10;
+
+	std::vector<CsrGraph<int>::edge_t> edges = {};
+
+	for (uint64_t ray = 1; ray <= rayAmount; ray++)
+	{
+		edges.push_back({ 0, ray, 1.0f });
+	}
+
+	for (uint64_t v = rayAmount + 2; v < rayAmount + 1 + pathLength; v++)
+	{
+		edges.push_back({ v - 1, v, 1.0f });
+	}
+
+	CsrGraph<int> graph = CsrGraph<int>::FromEdges(rayAmount + 1 + pathLength, edges, false, true);
+
+	profile::StartTimeProfiling();
+
+	std::vector<NFlatTree<int>> forest = CsrComponents<int>::FlatForest(graph, 1, true);
+	std::vector<NTree<int, 5>*> trees = CsrComponents<int>::Forest<5>(graph, 1, true);
+
+	profile::EndTimeProfiling();
+
+	bool starKept = forest.size() == 2 && forest[0].GetChildAmount(0) == rayAmount && forest[0].GetChildIndex(rayAmount) == rayAmount - 1;
+	bool pathKept = forest.size() == 2 && forest[1].GetDepth(pathLength - 1) == pathLength - 1;
+	bool starRejected = trees.size() == 2 && trees[0] == nullptr && trees[1] != nullptr;
+
+	std::cout << "6. Wide star forest took " << profile::GetProfiledTime().count() << " microseconds: star root has " << (forest.size() > 0 ? forest[0].GetChildAmount(0) : 0) << " children" << std::endl;
+	std::cout << "\t " << ((starKept && pathKept && starRejected) ? "OK" : "FAILED") << std::endl << std::endl;
+
+	for (NTree<int, 5>* component : trees)
+	{
+		delete component;
+	}
+}
+
 int main(int argc, const char** argv)
 {
 	// Открываем поток ввода для файла tree.nt
@@ -155,6 +384,15 @@ int main(int argc, const char** argv)
 		output.close();
 	}
 
+	// Сравнение раскладок дерева в памяти.
+	BenchmarkLayouts(tree);
+
+	// Сравнение порядков нумерации вершин.
+	BenchmarkReordering(tree);
+
+	// Лес компонент с деревом шире 16 бит.
+	CheckWideForest();
+
 	// Сериализируем основное дерево, его размер, а так же найденные отношения и поддеревья в поток cout.
 	// Таким образом сериализованные данные выведутся в консоль.
 
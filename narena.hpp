@@ -0,0 +1,712 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#endif
+
+#include "ntree.hpp"
+
+// Какими страницами памяти NArena поддерживает свои блоки.
+enum arena_pages_t : uint8_t
+{
+	// Обычная память из malloc.
+	PAGES_DEFAULT,
+
+	// Прозрачные огромные страницы: блок выравнивается по 2 МБ и помечается madvise(MADV_HUGEPAGE).
+	PAGES_TRANSPARENT_HUGE,
+
+	/*
+		Явные огромные страницы: MAP_HUGETLB в Linux, MEM_LARGE_PAGES в Windows.
+		Если их нет (не настроены в системе или нет привилегии), то используются прозрачные.
+	*/
+	PAGES_EXPLICIT_HUGE
+};
+
+// Порядок, в котором лепестки дерева раскладываются в памяти при NArena::Relayout и NArena::Compact.
+enum leaf_layout_t : uint8_t
+{
+	// В ширину: так же, как их создают Deserialize и GenerateTree.
+	LAYOUT_BFS,
+
+	// В глубину, прямой порядок: поддерево лежит одним непрерывным куском сразу за своим корнем.
+	LAYOUT_DFS,
+
+	/*
+		Порядок ван Эмде Боаса: дерево режется по половине высоты, сначала раскладывается верхняя
+		часть, затем каждое нижнее поддерево, и так рекурсивно. Путь от корня до листа задевает
+		O(log_B n) блоков памяти при любом размере кэш-линии и страницы.
+	*/
+	LAYOUT_VEB
+};
+
+/*
+	Хранилище лепестков большими непрерывными блоками.
+
+	Лепестки, выделенные через Allocate, лежат в памяти подряд в порядке выделения и
+	помечены флагом LEAF_FLAG_ARENA: их нельзя удалять через delete, они освобождаются
+	вместе с NArena. Смешивать в одном дереве лепестки из NArena и из new нельзя.
+*/
+template<typename T, uint16_t N>
+class NArena
+{
+public:
+	// Количество лепестков в блоке по умолчанию.
+	static constexpr size_t DEFAULT_BLOCK_CAPACITY = 4096;
+
+	// Размер огромной страницы, по которому выравниваются блоки при PAGES_*_HUGE.
+	static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+private:
+	// Откуда взята память блока. От этого зависит, как её освобождать.
+	enum block_source_t : uint8_t
+	{
+		BLOCK_MALLOC,
+		BLOCK_MAPPED,
+		BLOCK_MAPPED_HUGE
+	};
+
+	// Блок памяти под лепестки. Первые used лепестков сконструированы.
+	struct block_t
+	{
+		NLeaf<T, N>* leaves;
+		size_t capacity;
+		size_t used;
+
+		// Размер памяти блока в байтах и её источник.
+		size_t bytes;
+		block_source_t source;
+	};
+
+	// Все блоки в порядке выделения.
+	std::vector<block_t> mBlocks;
+
+	// Количество лепестков в новом блоке.
+	size_t mBlockCapacity;
+
+	// Какими страницами поддерживать блоки.
+	arena_pages_t mPages;
+
+	// Список свободных лепестков для повторного использования, связанный через mChildren[0].
+	NLeaf<T, N>* mFreeList = nullptr;
+	size_t mFreeAmount = 0;
+public:
+	/*
+		blockCapacity - количество лепестков в новом блоке.
+		pages - какими страницами поддерживать блоки. Огромные страницы сокращают промахи TLB
+		при случайном доступе к большим деревьям, для них стоит брать блоки от 2 МБ и больше.
+		Если огромные страницы недоступны, то блок тихо выделяется обычной памятью.
+	*/
+	NArena(size_t blockCapacity = DEFAULT_BLOCK_CAPACITY, arena_pages_t pages = PAGES_DEFAULT)
+	{
+		mBlockCapacity = blockCapacity;
+		mPages = pages;
+	}
+
+	// Уничтожение всех лепестков и освобождение блоков.
+	~NArena()
+	{
+		FreeBlocks(mBlocks);
+	}
+
+	NArena(const NArena&) = delete;
+	NArena& operator=(const NArena&) = delete;
+public:
+	// Выделение лепестка с изначальным значением. Сначала используются освобождённые лепестки.
+	NLeaf<T, N>* Allocate(T value)
+	{
+		if (mFreeList != nullptr)
+		{
+			NLeaf<T, N>* leaf = mFreeList;
+			mFreeList = leaf->mChildren[0];
+			mFreeAmount--;
+
+			leaf->~NLeaf();
+			new (leaf) NLeaf<T, N>(value);
+			leaf->mFlags |= NLeaf<T, N>::LEAF_FLAG_ARENA;
+
+			return leaf;
+		}
+
+		return AllocateInBlock(value);
+	}
+
+	/*
+		Гарантирует, что следующие amount лепестков, выделенных не из списка свободных, лягут подряд в один блок.
+		Если в текущем блоке места не хватает, выделяется новый блок, достаточный для всех сразу.
+	*/
+	void Reserve(size_t amount)
+	{
+		if (mBlocks.size() > 0 && mBlocks.back().capacity - mBlocks.back().used >= amount)
+		{
+			return;
+		}
+
+		AllocateBlock((amount > mBlockCapacity) ? amount : mBlockCapacity);
+	}
+
+	// Количество выделенных и не освобождённых лепестков.
+	size_t GetLeafAmount()
+	{
+		size_t result = 0;
+
+		for (const block_t& block : mBlocks)
+		{
+			result += block.used;
+		}
+
+		return result - mFreeAmount;
+	}
+
+	// Количество лепестков в списке свободных.
+	size_t GetFreeAmount()
+	{
+		return mFreeAmount;
+	}
+public:
+	/*
+		Возвращение отсоединённого поддерева в список свободных лепестков.
+		Значения лепестков сразу уничтожаются, а память будет использована следующими Allocate.
+	*/
+	void Release(NLeaf<T, N>* subtree)
+	{
+		if (subtree == nullptr)
+		{
+			return;
+		}
+
+		// Walk кладёт потомков в очередь до вызова лямбды, поэтому лепесток можно сразу переиспользовать.
+		subtree->Walk([&](NLeaf<T, N>* leaf) -> bool {
+			leaf->~NLeaf();
+			new (leaf) NLeaf<T, N>();
+
+			leaf->mFlags = NLeaf<T, N>::LEAF_FLAG_ARENA | NLeaf<T, N>::LEAF_FLAG_FREE;
+			leaf->mChildren[0] = mFreeList;
+
+			mFreeList = leaf;
+			mFreeAmount++;
+
+			return false;
+		});
+	}
+
+	// Удаление потомка parent по индексу с возвращением всего его поддерева в список свободных.
+	void RemoveNChild(NLeaf<T, N>* parent, uint16_t index)
+	{
+		Release(parent->DetachNChild(index));
+	}
+
+	/*
+		Уплотнение: дерево root переписывается в новые блоки подряд в порядке layout, старые блоки
+		освобождаются. Это возвращает локальность, потерянную после множества удалений и вставок.
+
+		Все остальные лепестки хранилища (другие деревья, список свободных) уничтожаются, а все
+		старые указатели на лепестки становятся недействительными. Возвращает новый корень.
+	*/
+	NLeaf<T, N>* Compact(NLeaf<T, N>* root, leaf_layout_t layout = LAYOUT_BFS)
+	{
+		std::vector<NLeaf<T, N>*> order = CollectLayout(root, layout);
+
+		std::vector<block_t> oldBlocks = {};
+		oldBlocks.swap(mBlocks);
+
+		mFreeList = nullptr;
+		mFreeAmount = 0;
+
+		NLeaf<T, N>* newRoot = CopyInOrder(root, order, true);
+
+		FreeBlocks(oldBlocks);
+
+		return newRoot;
+	}
+
+	/*
+		Физическая перекладка дерева: копия дерева source (из new или из любого NArena)
+		записывается в это хранилище одним непрерывным блоком в порядке layout.
+		Исходное дерево не меняется. Возвращает корень копии.
+	*/
+	NLeaf<T, N>* Relayout(NLeaf<T, N>* source, leaf_layout_t layout)
+	{
+		return CopyInOrder(source, CollectLayout(source, layout), false);
+	}
+
+	// Количество зарезервированных блоками байт.
+	size_t GetByteSize()
+	{
+		size_t result = 0;
+
+		for (const block_t& block : mBlocks)
+		{
+			result += block.bytes;
+		}
+
+		return result;
+	}
+
+	// Количество байт в блоках, которые точно получили явные огромные страницы.
+	size_t GetHugePageByteSize()
+	{
+		size_t result = 0;
+
+		for (const block_t& block : mBlocks)
+		{
+			result += (block.source == BLOCK_MAPPED_HUGE) ? block.bytes : 0;
+		}
+
+		return result;
+	}
+public:
+	/*
+		Копирование всего хранилища в пустое хранилище target.
+
+		Каждый блок копируется целиком (memcpy, если T тривиально копируемый), после чего
+		все указатели на родителя и потомков переводятся из адресов этого хранилища в адреса
+		target. Исправление указателей делится между threads потоками.
+
+		Копируются все деревья, лежащие в хранилище. Возвращается копия лепестка root.
+	*/
+	NLeaf<T, N>* Clone(NLeaf<T, N>* root, NArena<T, N>& target, unsigned threads = 1)
+	{
+		// Начало каждого блока в общей нумерации лепестков, чтобы делить работу между потоками.
+		std::vector<size_t> firstLeaves = {};
+		size_t leafAmount = 0;
+
+		for (const block_t& block : mBlocks)
+		{
+			block_t& copy = target.AllocateBlock(block.capacity);
+
+			if constexpr (std::is_trivially_copyable_v<T>)
+			{
+				memcpy(static_cast<void*>(copy.leaves), static_cast<const void*>(block.leaves), block.used * sizeof(NLeaf<T, N>));
+			}
+			else
+			{
+				for (size_t l = 0; l < block.used; l++)
+				{
+					new (&copy.leaves[l]) NLeaf<T, N>(block.leaves[l]);
+				}
+			}
+
+			copy.used = block.used;
+
+			firstLeaves.push_back(leafAmount);
+			leafAmount += block.used;
+		}
+
+		// Блоки target, соответствующие нашим блокам, идут последними.
+		size_t targetFirstBlock = target.mBlocks.size() - mBlocks.size();
+
+		// Блоки, отсортированные по адресу, для бинарного поиска блока по указателю.
+		std::vector<std::pair<NLeaf<T, N>*, size_t>> blocksByAddress = {};
+		for (size_t b = 0; b < mBlocks.size(); b++)
+		{
+			blocksByAddress.push_back({ mBlocks[b].leaves, b });
+		}
+
+		std::sort(blocksByAddress.begin(), blocksByAddress.end());
+
+		auto translate = [&](NLeaf<T, N>* leaf) -> NLeaf<T, N>* {
+			return TranslateInto(target, targetFirstBlock, blocksByAddress, leaf);
+		};
+
+		// Исправление указателей в лепестках с общими номерами [begin, end).
+		auto fixup = [&](size_t begin, size_t end) {
+			size_t b = 0;
+
+			for (size_t l = begin; l < end; l++)
+			{
+				while (l >= firstLeaves[b] + mBlocks[b].used)
+				{
+					b++;
+				}
+
+				NLeaf<T, N>& leaf = target.mBlocks[targetFirstBlock + b].leaves[l - firstLeaves[b]];
+
+				leaf.mParent = translate(leaf.mParent);
+
+				for (uint16_t c = 0; c < N; c++)
+				{
+					leaf.mChildren[c] = translate(leaf.mChildren[c]);
+				}
+			}
+		};
+
+		if (threads <= 1 || leafAmount < threads)
+		{
+			fixup(0, leafAmount);
+		}
+		else
+		{
+			std::vector<std::thread> workers = {};
+
+			for (unsigned t = 0; t < threads; t++)
+			{
+				workers.emplace_back(fixup, leafAmount * t / threads, leafAmount * (t + 1) / threads);
+			}
+
+			for (std::thread& worker : workers)
+			{
+				worker.join();
+			}
+		}
+
+		target.mFreeList = translate(mFreeList);
+		target.mFreeAmount = mFreeAmount;
+
+		return translate(root);
+	}
+private:
+	// Список лепестков дерева root в порядке layout. Родитель всегда идёт раньше потомков.
+	std::vector<NLeaf<T, N>*> CollectLayout(NLeaf<T, N>* root, leaf_layout_t layout)
+	{
+		std::vector<NLeaf<T, N>*> order = {};
+
+		if (layout == LAYOUT_VEB)
+		{
+			// Высота дерева в уровнях. Walk заодно обновляет устаревшую глубину.
+			uint16_t height = 0;
+			root->Walk([&](NLeaf<T, N>* leaf) -> bool {
+				uint16_t levels = leaf->mDepth - root->mDepth + 1;
+				height = (levels > height) ? levels : height;
+
+				return false;
+			});
+
+			CollectVanEmdeBoas(root, height, order);
+		}
+		else if (layout == LAYOUT_DFS)
+		{
+			std::vector<NLeaf<T, N>*> stack = { root };
+
+			while (stack.size() > 0)
+			{
+				NLeaf<T, N>* leaf = stack.back();
+				stack.pop_back();
+
+				order.push_back(leaf);
+
+				// Кладём потомков с конца, чтобы первый потомок был обработан первым.
+				for (uint16_t c = leaf->mChildrenAmount; c > 0; c--)
+				{
+					if (leaf->mChildren[c - 1] != nullptr)
+					{
+						stack.push_back(leaf->mChildren[c - 1]);
+					}
+				}
+			}
+		}
+		else
+		{
+			root->Walk([&](NLeaf<T, N>* leaf) -> bool {
+				order.push_back(leaf);
+
+				return false;
+			});
+		}
+
+		return order;
+	}
+
+	/*
+		Раскладка в порядке ван Эмде Боаса поддерева leaf высотой height уровней:
+		верхние height / 2 уровней, затем каждое поддерево под ними, всё рекурсивно.
+	*/
+	void CollectVanEmdeBoas(NLeaf<T, N>* leaf, uint16_t height, std::vector<NLeaf<T, N>*>& order)
+	{
+		if (height <= 1)
+		{
+			order.push_back(leaf);
+
+			return;
+		}
+
+		uint16_t topHeight = height / 2;
+		uint16_t bottomHeight = height - topHeight;
+
+		CollectVanEmdeBoas(leaf, topHeight, order);
+
+		// Корни нижних поддеревьев - лепестки ровно на topHeight уровней ниже leaf, слева направо.
+		std::vector<std::pair<NLeaf<T, N>*, uint16_t>> stack = { { leaf, 0 } };
+
+		while (stack.size() > 0)
+		{
+			NLeaf<T, N>* current = stack.back().first;
+			uint16_t level = stack.back().second;
+			stack.pop_back();
+
+			if (level == topHeight)
+			{
+				CollectVanEmdeBoas(current, bottomHeight, order);
+
+				continue;
+			}
+
+			for (uint16_t c = current->mChildrenAmount; c > 0; c--)
+			{
+				if (current->mChildren[c - 1] != nullptr)
+				{
+					stack.push_back({ current->mChildren[c - 1], level + 1 });
+				}
+			}
+		}
+	}
+
+	/*
+		Копирование лепестков order в один новый блок в том же порядке. Если moveValues
+		установлен, то значения переносятся из исходных лепестков, а не копируются.
+
+		Чтобы не заводить отображение "старый лепесток - новый", адрес копии временно
+		записывается в mParent старого лепестка, связи восстанавливаются сверху вниз через
+		mChildren, а потом старые родители возвращаются на место.
+	*/
+	NLeaf<T, N>* CopyInOrder(NLeaf<T, N>* root, const std::vector<NLeaf<T, N>*>& order, bool moveValues)
+	{
+		NLeaf<T, N>* rootParent = root->mParent;
+
+		Reserve(order.size());
+
+		for (NLeaf<T, N>* leaf : order)
+		{
+			// Список свободных не используем, чтобы копия легла одним куском.
+			NLeaf<T, N>* copy = moveValues ? AllocateInBlock(std::move(leaf->mValue)) : AllocateInBlock(leaf->mValue);
+			copy->mDepth = leaf->mDepth;
+			copy->mChildIndex = leaf->mChildIndex;
+
+			leaf->mParent = copy;
+		}
+
+		// Связываем копии. Родитель в order всегда раньше потомка, поэтому его глубина уже точная.
+		NLeaf<T, N>* newRoot = root->mParent;
+		newRoot->mParent = nullptr;
+		newRoot->mDepth = 0;
+		newRoot->mChildIndex = 0;
+
+		for (NLeaf<T, N>* leaf : order)
+		{
+			NLeaf<T, N>* copy = leaf->mParent;
+
+			for (uint16_t c = 0; c < leaf->mChildrenAmount; c++)
+			{
+				if (leaf->mChildren[c] == nullptr)
+				{
+					continue;
+				}
+
+				NLeaf<T, N>* child = leaf->mChildren[c]->mParent;
+
+				child->mChildIndex = copy->mChildrenAmount;
+				child->mDepth = copy->mDepth + 1;
+				child->mParent = copy;
+
+				copy->mChildren[copy->mChildrenAmount++] = child;
+			}
+		}
+
+		// Возвращаем исходному дереву его родителей.
+		for (NLeaf<T, N>* leaf : order)
+		{
+			for (uint16_t c = 0; c < leaf->mChildrenAmount; c++)
+			{
+				if (leaf->mChildren[c] != nullptr)
+				{
+					leaf->mChildren[c]->mParent = leaf;
+				}
+			}
+		}
+
+		root->mParent = rootParent;
+
+		return newRoot;
+	}
+
+	// Уничтожение всех лепестков в блоках и освобождение памяти блоков.
+	static void FreeBlocks(std::vector<block_t>& blocks)
+	{
+		for (block_t& block : blocks)
+		{
+			for (size_t l = 0; l < block.used; l++)
+			{
+				block.leaves[l].~NLeaf();
+			}
+
+			FreeBlockMemory(block);
+		}
+
+		blocks.clear();
+	}
+
+	// Выделение лепестка в конце последнего блока, минуя список свободных.
+	NLeaf<T, N>* AllocateInBlock(T value)
+	{
+		Reserve(1);
+
+		block_t& block = mBlocks.back();
+
+		NLeaf<T, N>* leaf = new (&block.leaves[block.used]) NLeaf<T, N>(value);
+		leaf->mFlags |= NLeaf<T, N>::LEAF_FLAG_ARENA;
+
+		block.used++;
+
+		return leaf;
+	}
+
+	/*
+		Выделение нового блока минимум на capacity лепестков.
+		Для огромных страниц размер округляется вверх до HUGE_PAGE_SIZE, и лишнее место
+		тоже отдаётся под лепестки.
+	*/
+	block_t& AllocateBlock(size_t capacity)
+	{
+		block_t block = { nullptr, capacity, 0, capacity * sizeof(NLeaf<T, N>), BLOCK_MALLOC };
+
+		if (mPages != PAGES_DEFAULT)
+		{
+			block.bytes = (block.bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+			AllocateHugeBlockMemory(block, mPages == PAGES_EXPLICIT_HUGE);
+		}
+
+		// Обычная память, если огромные страницы не заказаны или недоступны.
+		if (block.leaves == nullptr)
+		{
+			block.source = BLOCK_MALLOC;
+			block.leaves = static_cast<NLeaf<T, N>*>(malloc(block.bytes));
+
+			if (block.leaves == nullptr)
+			{
+				throw std::bad_alloc();
+			}
+		}
+
+		block.capacity = block.bytes / sizeof(NLeaf<T, N>);
+
+		mBlocks.push_back(block);
+
+		return mBlocks.back();
+	}
+
+	// Попытка выделить память блока огромными страницами. При неудаче block.leaves остаётся nullptr.
+	static void AllocateHugeBlockMemory(block_t& block, bool explicitPages)
+	{
+#if defined(_WIN32)
+		SIZE_T largePage = GetLargePageMinimum();
+
+		if (explicitPages && largePage > 0 && block.bytes % largePage == 0)
+		{
+			// Требует привилегии SeLockMemoryPrivilege, без неё просто вернёт NULL.
+			block.leaves = static_cast<NLeaf<T, N>*>(VirtualAlloc(nullptr, block.bytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE));
+			block.source = BLOCK_MAPPED_HUGE;
+		}
+
+		// Прозрачных огромных страниц в Windows нет, поэтому просто берём память у системы напрямую.
+		if (block.leaves == nullptr)
+		{
+			block.leaves = static_cast<NLeaf<T, N>*>(VirtualAlloc(nullptr, block.bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+			block.source = BLOCK_MAPPED;
+		}
+#elif defined(__unix__) || defined(__APPLE__)
+#if defined(MAP_HUGETLB)
+		if (explicitPages)
+		{
+			void* memory = mmap(nullptr, block.bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+			if (memory != MAP_FAILED)
+			{
+				block.leaves = static_cast<NLeaf<T, N>*>(memory);
+				block.source = BLOCK_MAPPED_HUGE;
+
+				return;
+			}
+		}
+#endif
+
+		// Берём на одну огромную страницу больше и обрезаем края, чтобы блок был выровнен по ней.
+		size_t mappedBytes = block.bytes + HUGE_PAGE_SIZE;
+		void* memory = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (memory == MAP_FAILED)
+		{
+			return;
+		}
+
+		uintptr_t begin = reinterpret_cast<uintptr_t>(memory);
+		uintptr_t aligned = (begin + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+		if (aligned > begin)
+		{
+			munmap(memory, aligned - begin);
+		}
+
+		if (begin + mappedBytes > aligned + block.bytes)
+		{
+			munmap(reinterpret_cast<void*>(aligned + block.bytes), begin + mappedBytes - (aligned + block.bytes));
+		}
+
+#if defined(MADV_HUGEPAGE)
+		// Подсказка ядру. Если THP выключены, то она просто игнорируется.
+		madvise(reinterpret_cast<void*>(aligned), block.bytes, MADV_HUGEPAGE);
+#endif
+
+		block.leaves = reinterpret_cast<NLeaf<T, N>*>(aligned);
+		block.source = BLOCK_MAPPED;
+#endif
+	}
+
+	// Освобождение памяти блока тем же способом, которым она была выделена.
+	static void FreeBlockMemory(block_t& block)
+	{
+		if (block.source == BLOCK_MALLOC)
+		{
+			free(block.leaves);
+
+			return;
+		}
+
+#if defined(_WIN32)
+		VirtualFree(block.leaves, 0, MEM_RELEASE);
+#elif defined(__unix__) || defined(__APPLE__)
+		munmap(block.leaves, block.bytes);
+#endif
+	}
+
+	// Перевод указателя на лепесток этого хранилища в указатель на его копию в target.
+	NLeaf<T, N>* TranslateInto(NArena<T, N>& target, size_t targetFirstBlock, const std::vector<std::pair<NLeaf<T, N>*, size_t>>& blocksByAddress, NLeaf<T, N>* leaf)
+	{
+		if (leaf == nullptr)
+		{
+			return nullptr;
+		}
+
+		// Последний блок, начинающийся не дальше указателя.
+		auto found = std::upper_bound(blocksByAddress.begin(), blocksByAddress.end(), leaf, [](NLeaf<T, N>* pointer, const std::pair<NLeaf<T, N>*, size_t>& block) -> bool {
+			return std::less<NLeaf<T, N>*>()(pointer, block.first);
+		});
+
+		if (found == blocksByAddress.begin())
+		{
+			return leaf;
+		}
+
+		const block_t& block = mBlocks[(found - 1)->second];
+
+		if (leaf >= block.leaves + block.capacity)
+		{
+			return leaf;
+		}
+
+		return target.mBlocks[targetFirstBlock + (found - 1)->second].leaves + (leaf - block.leaves);
+	}
+};
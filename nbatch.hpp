@@ -0,0 +1,184 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "narena.hpp"
+
+/*
+	Пакет изменений дерева, применяемый за один проход.
+
+	Операции (добавление потомка, удаление поддерева, установка значения) сначала только
+	записываются, а в Apply сортируются по родителю в порядке обхода в ширину и применяются
+	группами: каждый родитель трогается один раз, память под все новые лепестки резервируется
+	один раз, а удалённые поддеревья освобождаются одним проходом в конце.
+
+	Индексы в RemoveNChild относятся к состоянию дерева до применения пакета.
+*/
+template<typename T, uint16_t N>
+class NBatch
+{
+private:
+	// Вид операции. Порядок важен: внутри одного лепестка операции применяются именно так.
+	enum operation_kind_t : uint8_t
+	{
+		OPERATION_SET_VALUE,
+		OPERATION_REMOVE,
+		OPERATION_ATTACH
+	};
+
+	// Записанная операция.
+	struct operation_t
+	{
+		operation_kind_t kind;
+
+		// Лепесток, к которому относится операция (для добавления и удаления - родитель).
+		NLeaf<T, N>* leaf;
+
+		// Индекс удаляемого потомка.
+		uint16_t index;
+
+		// Значение для установки или для нового потомка.
+		T value;
+	};
+
+	std::vector<operation_t> mOperations;
+public:
+	// Резервирование места под amount операций.
+	void Reserve(size_t amount)
+	{
+		mOperations.reserve(amount);
+	}
+
+	// Добавление нового потомка со значением value последним потомком parent.
+	void AttachNChild(NLeaf<T, N>* parent, T value)
+	{
+		mOperations.push_back({ OPERATION_ATTACH, parent, 0, value });
+	}
+
+	// Удаление поддерева потомка parent по индексу.
+	void RemoveNChild(NLeaf<T, N>* parent, uint16_t index)
+	{
+		mOperations.push_back({ OPERATION_REMOVE, parent, index, T() });
+	}
+
+	// Установка значения лепестка.
+	void SetValue(NLeaf<T, N>* leaf, T value)
+	{
+		mOperations.push_back({ OPERATION_SET_VALUE, leaf, 0, value });
+	}
+
+	// Количество записанных операций.
+	size_t GetSize()
+	{
+		return mOperations.size();
+	}
+
+	void Clear()
+	{
+		mOperations.clear();
+	}
+public:
+	/*
+		Применение всех записанных операций. Если передан arena, то новые лепестки выделяются в нём
+		одним непрерывным блоком, иначе через new. Лепестки дерева и arena не должны смешиваться
+		с лепестками из new (см. NArena).
+
+		Возвращает количество применённых операций. Пропускаются удаления несуществующих потомков
+		и добавления в уже заполненного родителя. После применения пакет пуст.
+	*/
+	size_t Apply(NArena<T, N>* arena = nullptr)
+	{
+		// Сортировка по родителю в порядке обхода в ширину: сначала по глубине, затем по лепестку.
+		std::stable_sort(mOperations.begin(), mOperations.end(), [](const operation_t& a, const operation_t& b) -> bool {
+			if (a.leaf->GetDepth() != b.leaf->GetDepth())
+			{
+				return a.leaf->GetDepth() < b.leaf->GetDepth();
+			}
+
+			if (a.leaf != b.leaf)
+			{
+				return std::less<NLeaf<T, N>*>()(a.leaf, b.leaf);
+			}
+
+			if (a.kind != b.kind)
+			{
+				return a.kind < b.kind;
+			}
+
+			// Удаляем с конца, чтобы сдвиг потомков не сбивал индексы следующих удалений.
+			return a.kind == OPERATION_REMOVE && a.index > b.index;
+		});
+
+		// Резервируем место под все новые лепестки сразу.
+		if (arena != nullptr)
+		{
+			size_t attachAmount = std::count_if(mOperations.begin(), mOperations.end(), [](const operation_t& operation) -> bool {
+				return operation.kind == OPERATION_ATTACH;
+			});
+
+			arena->Reserve(attachAmount);
+		}
+
+		/*
+			Удалённые поддеревья освобождаются только в конце: в них могут лежать родители
+			операций, которые ещё не применены, так как они глубже.
+		*/
+		std::vector<NLeaf<T, N>*> removed = {};
+
+		size_t applied = 0;
+
+		for (size_t o = 0; o < mOperations.size(); o++)
+		{
+			const operation_t& operation = mOperations[o];
+
+			switch (operation.kind)
+			{
+			case OPERATION_SET_VALUE:
+				operation.leaf->SetValue(operation.value);
+				applied++;
+				break;
+			case OPERATION_REMOVE:
+				// Повторное удаление того же потомка пропускаем.
+				if (o > 0 && mOperations[o - 1].kind == OPERATION_REMOVE && mOperations[o - 1].leaf == operation.leaf && mOperations[o - 1].index == operation.index)
+				{
+					break;
+				}
+
+				if (operation.index < operation.leaf->GetChildAmount())
+				{
+					removed.push_back(operation.leaf->DetachNChild(operation.index));
+					applied++;
+				}
+				break;
+			case OPERATION_ATTACH:
+				if (operation.leaf->GetChildAmount() < N)
+				{
+					NLeaf<T, N>* leaf = (arena != nullptr) ? arena->Allocate(operation.value) : new NLeaf<T, N>(operation.value);
+
+					operation.leaf->GraftNChild(leaf);
+					applied++;
+				}
+				break;
+			}
+		}
+
+		// Лепестки из arena возвращаем в его список свободных, остальные удаляем.
+		for (NLeaf<T, N>* leaf : removed)
+		{
+			if (arena != nullptr)
+			{
+				arena->Release(leaf);
+			}
+			else
+			{
+				delete leaf;
+			}
+		}
+
+		mOperations.clear();
+
+		return applied;
+	}
+};
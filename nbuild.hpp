@@ -0,0 +1,207 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "narena.hpp"
+#include "nutility.hpp"
+
+/*
+	Массовое построение дерева из массива родителей или списка рёбер за линейное время.
+
+	Вместо вызова SetNChild на каждого потомка построение идёт как у CSR: сначала считается
+	количество детей каждого лепестка, префиксная сумма превращает счётчики в смещения, и
+	все потомки раскладываются по своим местам за один проход. Затем обход в ширину по этим
+	смещениям выдаёт порядок и глубину всех лепестков сразу, лепестки выделяются подряд
+	в этом порядке и связываются напрямую, без поштучного обновления глубины.
+
+	Лепестки пронумерованы от 0 до n - 1, потомки каждого лепестка идут в порядке
+	возрастания номеров. Подсчёт детей и связывание лепестков идут в threads потоков.
+*/
+template<typename T, uint16_t N>
+class NBuilder
+{
+public:
+	// Номер отсутствующего родителя (у корня).
+	static constexpr uint64_t INVALID_LEAF = UINT64_MAX;
+
+	// Ребро (родитель, потомок).
+	using edge_t = std::pair<uint64_t, uint64_t>;
+private:
+	// Диапазоны меньше этого размера не делятся между потоками.
+	static constexpr size_t PARALLEL_RANGE_SIZE = 65536;
+public:
+	/*
+		Построение дерева по массиву родителей: parents[i] - номер родителя лепестка i или
+		INVALID_LEAF у корня, values[i] - его значение. Если передан arena, то лепестки
+		выделяются в нём подряд в порядке обхода в ширину, иначе через new.
+
+		Возвращает корень или nullptr, если массив не задаёт дерево: корней не ровно один,
+		есть цикл или у какого-то лепестка больше N детей.
+	*/
+	static NLeaf<T, N>* FromParents(const std::vector<uint64_t>& parents, const std::vector<T>& values, NArena<T, N>* arena = nullptr, uint16_t threads = 1)
+	{
+		size_t leafAmount = parents.size();
+		if (leafAmount <= 0 || values.size() != leafAmount)
+		{
+			return nullptr;
+		}
+
+		// Подсчёт детей каждого лепестка и поиск корня.
+		std::vector<uint32_t> counts(leafAmount + 1, 0);
+		std::atomic<uint64_t> root = INVALID_LEAF;
+		std::atomic<bool> valid = true;
+
+		NParallel::ForRange(leafAmount, threads, PARALLEL_RANGE_SIZE, [&](size_t begin, size_t end) {
+			for (size_t l = begin; l < end; l++)
+			{
+				uint64_t parent = parents[l];
+
+				if (parent == INVALID_LEAF)
+				{
+					uint64_t expected = INVALID_LEAF;
+					if (!root.compare_exchange_strong(expected, l))
+					{
+						valid = false;
+					}
+				}
+				else if (parent >= leafAmount)
+				{
+					valid = false;
+				}
+				else
+				{
+					std::atomic_ref<uint32_t>(counts[parent]).fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+		});
+
+		if (!valid || root == INVALID_LEAF)
+		{
+			return nullptr;
+		}
+
+		// Префиксная сумма: потомки лепестка l лежат в children с offsets[l] до offsets[l + 1].
+		std::vector<uint64_t> offsets(leafAmount + 1, 0);
+
+		for (size_t l = 0; l < leafAmount; l++)
+		{
+			if (counts[l] > N)
+			{
+				return nullptr;
+			}
+
+			offsets[l + 1] = offsets[l] + counts[l];
+		}
+
+		// Раскладка потомков по местам. Проход по возрастанию номеров сохраняет их порядок.
+		std::vector<uint64_t> children(leafAmount - 1);
+		std::vector<uint64_t> cursors(offsets.begin(), offsets.end() - 1);
+
+		for (size_t l = 0; l < leafAmount; l++)
+		{
+			if (parents[l] != INVALID_LEAF)
+			{
+				children[cursors[parents[l]]++] = l;
+			}
+		}
+
+		/*
+			Обход в ширину по смещениям. Дальше всё считается по позициям в этом порядке:
+			потомки лепестка на позиции p занимают позиции подряд с firstChildren[p], поэтому
+			и глубины, и связывание идут последовательно по памяти.
+		*/
+		std::vector<uint64_t> order = {};
+		order.reserve(leafAmount);
+		order.push_back(root);
+
+		std::vector<uint64_t> firstChildren(leafAmount + 1, 0);
+		std::vector<uint16_t> depths(leafAmount, 0);
+
+		for (size_t p = 0; p < order.size(); p++)
+		{
+			uint64_t leaf = order[p];
+
+			firstChildren[p] = order.size();
+
+			for (uint64_t c = offsets[leaf]; c < offsets[leaf + 1]; c++)
+			{
+				depths[order.size()] = depths[p] + 1;
+				order.push_back(children[c]);
+			}
+		}
+
+		// Лепестки, недостижимые из корня, лежат на цикле.
+		if (order.size() != leafAmount)
+		{
+			return nullptr;
+		}
+
+		firstChildren[leafAmount] = leafAmount;
+
+		// Выделение лепестков подряд в порядке обхода в ширину.
+		std::vector<NLeaf<T, N>*> leaves(leafAmount, nullptr);
+
+		if (arena != nullptr)
+		{
+			arena->Reserve(leafAmount);
+		}
+
+		for (size_t p = 0; p < leafAmount; p++)
+		{
+			leaves[p] = (arena != nullptr) ? arena->Allocate(values[order[p]]) : new NLeaf<T, N>(values[order[p]]);
+		}
+
+		// Связывание: каждый лепесток заполняет свои поля и поля своих потомков, поэтому потоки не пересекаются.
+		NParallel::ForRange(leafAmount, threads, PARALLEL_RANGE_SIZE, [&](size_t begin, size_t end) {
+			for (size_t p = begin; p < end; p++)
+			{
+				NLeaf<T, N>* leaf = leaves[p];
+
+				leaf->mDepth = depths[p];
+				leaf->mChildrenAmount = (uint16_t)(firstChildren[p + 1] - firstChildren[p]);
+
+				for (uint16_t c = 0; c < leaf->mChildrenAmount; c++)
+				{
+					NLeaf<T, N>* child = leaves[firstChildren[p] + c];
+
+					leaf->mChildren[c] = child;
+					child->mParent = leaf;
+					child->mChildIndex = c;
+				}
+			}
+		});
+
+		return leaves[0];
+	}
+
+	/*
+		Построение дерева по списку рёбер (родитель, потомок) на лепестках от 0 до values.size() - 1.
+		Возвращает nullptr, если у какого-то лепестка больше одного родителя или рёбра не задают дерево.
+	*/
+	static NLeaf<T, N>* FromEdges(const std::vector<edge_t>& edges, const std::vector<T>& values, NArena<T, N>* arena = nullptr, uint16_t threads = 1)
+	{
+		size_t leafAmount = values.size();
+		if (edges.size() + 1 != leafAmount)
+		{
+			return nullptr;
+		}
+
+		std::vector<uint64_t> parents(leafAmount, INVALID_LEAF);
+
+		for (const edge_t& edge : edges)
+		{
+			if (edge.first >= leafAmount || edge.second >= leafAmount || parents[edge.second] != INVALID_LEAF)
+			{
+				return nullptr;
+			}
+
+			parents[edge.second] = edge.first;
+		}
+
+		return FromParents(parents, values, arena, threads);
+	}
+};
@@ -0,0 +1,319 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "ntree.hpp"
+
+/*
+	Каноническая форма формы дерева без учёта порядка потомков (алгоритм AHU).
+
+	Каждому поддереву выдаётся номер формы: два поддерева получают один и тот же номер тогда
+	и только тогда, когда они изоморфны, то есть совпадают с точностью до перестановки
+	потомков (а если включены значения, то и значения лепестков совпадают). Номер формы
+	лепестка определяется его значением и отсортированными номерами форм его потомков.
+
+	Словарь форм общий для всех деревьев, прошедших через один NCanonizer, поэтому номер
+	корня - это канонический код всего дерева: проверка изоморфизма - это сравнение чисел,
+	а тысячи деревьев группируются по форме за один проход по каждому, без попарных сравнений.
+
+	Номера форм считаются по уровням снизу вверх, а лепестки одного уровня независимы
+	и обрабатываются параллельно. Словарь разбит на сегменты со своими замками.
+*/
+template<typename T, uint16_t N>
+class NCanonizer
+{
+private:
+	// Ключ формы: значение (если учитывается) и отсортированные номера форм потомков.
+	struct shape_key_t
+	{
+		T value;
+		std::vector<uint32_t> children;
+
+		bool operator==(const shape_key_t& other) const
+		{
+			return value == other.value && children == other.children;
+		}
+	};
+
+	struct shape_hash_t
+	{
+		size_t operator()(const shape_key_t& key) const
+		{
+			uint64_t hash = std::hash<T>()(key.value);
+
+			for (uint32_t child : key.children)
+			{
+				hash = (hash ^ child) * 0x100000001b3;
+			}
+
+			return (size_t)(hash ^ (hash >> 32));
+		}
+	};
+
+	// Сегмент словаря. Выровнен по кэш-линии, чтобы замки разных сегментов не делили её.
+	struct alignas(64) shard_t
+	{
+		std::mutex mutex;
+		std::unordered_map<shape_key_t, uint32_t, shape_hash_t> shapes;
+	};
+
+	static constexpr size_t SHARD_AMOUNT = 64;
+
+	// Уровни меньше этого размера обрабатываются в вызывающем потоке: создавать потоки дороже.
+	static constexpr size_t PARALLEL_LEVEL_SIZE = 4096;
+
+	shard_t mShards[SHARD_AMOUNT];
+
+	// Следующий свободный номер формы.
+	std::atomic<uint32_t> mShapeAmount = 0;
+
+	// Обратный словарь для Encode: ключ формы по номеру. Ключи в сегментах не перемещаются и не удаляются.
+	std::vector<const shape_key_t*> mKeys;
+	std::mutex mKeysMutex;
+
+	bool mIncludeValues;
+public:
+	// includeValues - учитывать ли значения лепестков, а не только форму.
+	NCanonizer(bool includeValues = false)
+	{
+		mIncludeValues = includeValues;
+	}
+
+	NCanonizer(const NCanonizer&) = delete;
+	NCanonizer& operator=(const NCanonizer&) = delete;
+public:
+	// Номер формы дерева tree. Деревья изоморфны тогда и только тогда, когда номера равны.
+	uint32_t Canonize(NLeaf<T, N>* tree, uint16_t threads = 1)
+	{
+		// Уровни дерева в порядке обхода в ширину и начало потомков каждого лепестка на следующем уровне.
+		std::vector<std::vector<NLeaf<T, N>*>> levels = { { tree } };
+		std::vector<std::vector<size_t>> childStarts = {};
+
+		while (levels.back().size() > 0)
+		{
+			const std::vector<NLeaf<T, N>*>& level = levels.back();
+
+			std::vector<NLeaf<T, N>*> next = {};
+			std::vector<size_t> starts(level.size() + 1);
+
+			for (size_t l = 0; l < level.size(); l++)
+			{
+				starts[l] = next.size();
+
+				for (uint16_t c = 0; c < level[l]->GetChildAmount(); c++)
+				{
+					NLeaf<T, N>* child = *level[l]->GetNChild(c);
+					if (child != nullptr)
+					{
+						next.push_back(child);
+					}
+				}
+			}
+
+			starts[level.size()] = next.size();
+
+			childStarts.push_back(std::move(starts));
+			levels.push_back(std::move(next));
+		}
+
+		levels.pop_back();
+
+		// Номера форм уровня ниже текущего.
+		std::vector<uint32_t> childShapes = {};
+
+		for (size_t d = levels.size(); d > 0; d--)
+		{
+			const std::vector<NLeaf<T, N>*>& level = levels[d - 1];
+			const std::vector<size_t>& starts = childStarts[d - 1];
+
+			std::vector<uint32_t> shapes(level.size());
+
+			auto canonizeRange = [&](size_t begin, size_t end) {
+				shape_key_t key = {};
+
+				for (size_t l = begin; l < end; l++)
+				{
+					key.value = mIncludeValues ? level[l]->GetValue() : T();
+					key.children.assign(childShapes.begin() + starts[l], childShapes.begin() + starts[l + 1]);
+					std::sort(key.children.begin(), key.children.end());
+
+					shapes[l] = GetShape(key);
+				}
+			};
+
+			if (threads <= 1 || level.size() < PARALLEL_LEVEL_SIZE)
+			{
+				canonizeRange(0, level.size());
+			}
+			else
+			{
+				std::vector<std::thread> workers = {};
+				size_t chunk = (level.size() + threads - 1) / threads;
+
+				for (size_t begin = 0; begin < level.size(); begin += chunk)
+				{
+					workers.emplace_back(canonizeRange, begin, std::min(begin + chunk, level.size()));
+				}
+
+				for (std::thread& worker : workers)
+				{
+					worker.join();
+				}
+			}
+
+			childShapes.swap(shapes);
+		}
+
+		return childShapes[0];
+	}
+
+	// Проверка изоморфизма двух деревьев.
+	bool Isomorphic(NLeaf<T, N>* a, NLeaf<T, N>* b, uint16_t threads = 1)
+	{
+		return Canonize(a, threads) == Canonize(b, threads);
+	}
+
+	// Группировка деревьев по форме: каждая группа - индексы изоморфных деревьев в trees.
+	std::vector<std::vector<size_t>> Group(const std::vector<NLeaf<T, N>*>& trees, uint16_t threads = 1)
+	{
+		std::unordered_map<uint32_t, size_t> groupOf = {};
+		std::vector<std::vector<size_t>> groups = {};
+
+		for (size_t t = 0; t < trees.size(); t++)
+		{
+			uint32_t shape = Canonize(trees[t], threads);
+
+			auto found = groupOf.find(shape);
+			if (found == groupOf.end())
+			{
+				found = groupOf.insert({ shape, groups.size() }).first;
+				groups.push_back({});
+			}
+
+			groups[found->second].push_back(t);
+		}
+
+		return groups;
+	}
+
+	// Количество различных форм в словаре.
+	uint32_t GetShapeAmount() const
+	{
+		return mShapeAmount.load();
+	}
+
+	/*
+		Каноническая строка формы в виде скобочной записи AHU: "(" + значение, если оно
+		учитывается, + отсортированные строки потомков + ")". В отличие от номера формы
+		не зависит от словаря, поэтому её можно сравнивать между разными NCanonizer и сохранять.
+		Для номера, которого нет в словаре, возвращается пустая строка.
+	*/
+	std::string Encode(uint32_t shape)
+	{
+		std::lock_guard<std::mutex> lock(mKeysMutex);
+
+		if (shape >= mKeys.size() || mKeys[shape] == nullptr)
+		{
+			return "";
+		}
+
+		// Строки только тех форм, из которых состоит shape. Потомок всегда строится раньше родителя.
+		std::unordered_map<uint32_t, std::string> encodings = {};
+		std::vector<uint32_t> toEncode = { shape };
+
+		while (toEncode.size() > 0)
+		{
+			uint32_t current = toEncode.back();
+			if (encodings.count(current) > 0)
+			{
+				toEncode.pop_back();
+				continue;
+			}
+
+			const shape_key_t* key = mKeys[current];
+			bool ready = true;
+
+			for (uint32_t child : key->children)
+			{
+				if (encodings.count(child) <= 0)
+				{
+					toEncode.push_back(child);
+					ready = false;
+				}
+			}
+
+			if (!ready)
+			{
+				continue;
+			}
+
+			toEncode.pop_back();
+
+			std::vector<const std::string*> children = {};
+			for (uint32_t child : key->children)
+			{
+				children.push_back(&encodings[child]);
+			}
+
+			std::sort(children.begin(), children.end(), [](const std::string* first, const std::string* second) {
+				return *first < *second;
+			});
+
+			std::ostringstream encoding = {};
+			encoding << "(";
+
+			if (mIncludeValues)
+			{
+				encoding << key->value;
+			}
+
+			for (const std::string* child : children)
+			{
+				encoding << *child;
+			}
+
+			encoding << ")";
+
+			encodings[current] = encoding.str();
+		}
+
+		return encodings[shape];
+	}
+private:
+	// Номер формы по ключу: существующий или новый.
+	uint32_t GetShape(const shape_key_t& key)
+	{
+		shard_t& shard = mShards[shape_hash_t()(key) % SHARD_AMOUNT];
+
+		std::lock_guard<std::mutex> lock(shard.mutex);
+
+		auto found = shard.shapes.find(key);
+		if (found != shard.shapes.end())
+		{
+			return found->second;
+		}
+
+		uint32_t shape = mShapeAmount.fetch_add(1);
+		const shape_key_t& inserted = shard.shapes.insert({ key, shape }).first->first;
+
+		std::lock_guard<std::mutex> keysLock(mKeysMutex);
+
+		if (mKeys.size() <= shape)
+		{
+			mKeys.resize(shape + 1, nullptr);
+		}
+
+		mKeys[shape] = &inserted;
+
+		return shape;
+	}
+};
@@ -0,0 +1,219 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "nflat.hpp"
+
+/*
+	Представление топологии дерева в виде CSR (compressed sparse row) без копирования.
+
+	Рёбра лепестка i (его потомки) - это targets[k] для k от offsets[i] до offsets[i + 1],
+	значения лежат параллельным массивом values. Такие массивы можно сразу отдавать
+	графовым алгоритмам и численному коду.
+
+	Если лепестки пронумерованы в порядке обхода в ширину, то потомки идут подряд и
+	targets[k] = k + 1, поэтому массив targets не хранится вовсе (неявные цели).
+	Именно так устроено NFlatTree, и View над ним ничего не копирует.
+*/
+template<typename T>
+class NCsrView
+{
+private:
+	uint64_t mLeafAmount = 0;
+
+	const uint64_t* mOffsets = nullptr;
+
+	// nullptr, если цели неявные: targets[k] = k + 1.
+	const uint64_t* mTargets = nullptr;
+
+	const T* mValues = nullptr;
+public:
+	NCsrView() = default;
+
+	// Представление над готовыми массивами. targets может быть nullptr для неявных целей.
+	NCsrView(uint64_t leafAmount, const uint64_t* offsets, const uint64_t* targets, const T* values)
+	{
+		mLeafAmount = leafAmount;
+		mOffsets = offsets;
+		mTargets = targets;
+		mValues = values;
+	}
+
+	// Представление над плоским деревом без копирования.
+	static NCsrView<T> View(const NFlatTree<T>& tree)
+	{
+		return NCsrView<T>(tree.GetLeafAmount(), tree.GetOffsets(), nullptr, tree.GetValues());
+	}
+public:
+	uint64_t GetLeafAmount() const
+	{
+		return mLeafAmount;
+	}
+
+	// Количество рёбер: у дерева на одно меньше, чем лепестков.
+	uint64_t GetEdgeAmount() const
+	{
+		return (mLeafAmount > 0) ? mOffsets[mLeafAmount] - mOffsets[0] : 0;
+	}
+
+	// Массивы как есть: смещения (leafAmount + 1), цели (nullptr для неявных) и значения.
+
+	const uint64_t* GetOffsets() const
+	{
+		return mOffsets;
+	}
+
+	const uint64_t* GetTargets() const
+	{
+		return mTargets;
+	}
+
+	const T* GetValues() const
+	{
+		return mValues;
+	}
+
+	bool HasImplicitTargets() const
+	{
+		return mTargets == nullptr;
+	}
+
+	// Цель ребра с номером edge.
+	uint64_t GetTarget(uint64_t edge) const
+	{
+		return (mTargets != nullptr) ? mTargets[edge] : edge + 1;
+	}
+
+	// Доступ по лепесткам, как у NLeaf, но без ограничения количества детей 16 битами.
+
+	uint64_t GetChildAmount(uint64_t leaf) const
+	{
+		return mOffsets[leaf + 1] - mOffsets[leaf];
+	}
+
+	uint64_t GetNChild(uint64_t leaf, uint64_t index) const
+	{
+		return GetTarget(mOffsets[leaf] + index);
+	}
+
+	T GetValue(uint64_t leaf) const
+	{
+		return mValues[leaf];
+	}
+};
+
+/*
+	Выгрузка дерева NLeaf в CSR-массивы, которыми владеет этот объект.
+
+	В порядке обхода в ширину выгружаются только смещения и значения (цели неявные),
+	в порядке обхода в глубину (прямом) - ещё и массив целей. Порядок в глубину полезен,
+	когда поддерево каждого лепестка должно занимать непрерывный диапазон номеров.
+*/
+template<typename T>
+class NCsrTree
+{
+private:
+	std::vector<uint64_t> mOffsets;
+	std::vector<uint64_t> mTargets;
+	std::vector<T> mValues;
+public:
+	// Выгрузка дерева за один обход. depthFirst выбирает нумерацию в глубину вместо нумерации в ширину.
+	template<uint16_t N>
+	static NCsrTree<T> FromTree(NLeaf<T, N>* tree, bool depthFirst = false)
+	{
+		NCsrTree<T> result;
+
+		if (!depthFirst)
+		{
+			result.mOffsets.push_back(0);
+
+			tree->Walk([&](NLeaf<T, N>* leaf) -> bool {
+				uint64_t childAmount = 0;
+
+				for (uint16_t c = 0; c < leaf->GetChildAmount(); c++)
+				{
+					if (*leaf->GetNChild(c) != nullptr)
+					{
+						childAmount++;
+					}
+				}
+
+				result.mOffsets.push_back(result.mOffsets.back() + childAmount);
+				result.mValues.push_back(leaf->GetValue());
+
+				return false;
+			});
+
+			return result;
+		}
+
+		// Прямой обход в глубину: номер выдаётся при снятии со стека, потомки кладутся в обратном порядке.
+		std::vector<NLeaf<T, N>*> order = {};
+		std::vector<NLeaf<T, N>*> toVisit = { tree };
+		std::unordered_map<const NLeaf<T, N>*, uint64_t> numbers = {};
+
+		while (toVisit.size() > 0)
+		{
+			NLeaf<T, N>* leaf = toVisit.back();
+			toVisit.pop_back();
+
+			numbers[leaf] = order.size();
+			order.push_back(leaf);
+
+			for (uint16_t c = leaf->GetChildAmount(); c > 0; c--)
+			{
+				if (*leaf->GetNChild(c - 1) != nullptr)
+				{
+					toVisit.push_back(*leaf->GetNChild(c - 1));
+				}
+			}
+		}
+
+		result.mOffsets.reserve(order.size() + 1);
+		result.mTargets.reserve(order.size() - 1);
+		result.mValues.reserve(order.size());
+
+		result.mOffsets.push_back(0);
+
+		for (NLeaf<T, N>* leaf : order)
+		{
+			for (uint16_t c = 0; c < leaf->GetChildAmount(); c++)
+			{
+				if (*leaf->GetNChild(c) != nullptr)
+				{
+					result.mTargets.push_back(numbers[*leaf->GetNChild(c)]);
+				}
+			}
+
+			result.mOffsets.push_back(result.mTargets.size());
+			result.mValues.push_back(leaf->GetValue());
+		}
+
+		return result;
+	}
+public:
+	// Представление над массивами этого объекта. Действительно, пока объект жив и не менялся.
+	NCsrView<T> GetView() const
+	{
+		return NCsrView<T>(mValues.size(), mOffsets.data(), (mTargets.size() > 0) ? mTargets.data() : nullptr, mValues.data());
+	}
+
+	// Передача массивов наружу без копирования.
+
+	std::vector<uint64_t>& GetOffsets()
+	{
+		return mOffsets;
+	}
+
+	std::vector<uint64_t>& GetTargets()
+	{
+		return mTargets;
+	}
+
+	std::vector<T>& GetValues()
+	{
+		return mValues;
+	}
+};
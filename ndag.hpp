@@ -0,0 +1,381 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ntree.hpp"
+
+template<typename T, uint16_t N>
+class NDag;
+
+/*
+	Лепесток дерева, представленного через NDag. Это не хранимый объект, а позиция в дереве:
+	одно и то же общее поддерево встречается в дереве много раз, и глубина и индекс у каждого
+	вхождения свои, поэтому они вычисляются по пути от корня и хранятся здесь.
+*/
+template<typename T, uint16_t N>
+class NDagLeaf
+{
+	friend class NDag<T, N>;
+private:
+	const NDag<T, N>* mDag;
+
+	// Номер общего узла в NDag.
+	uint32_t mNode;
+
+	uint16_t mDepth;
+	uint16_t mChildIndex;
+public:
+	// Получение потомка по индексу.
+	NDagLeaf<T, N> GetNChild(uint16_t index) const
+	{
+		return { mDag, mDag->mNodes[mNode].children[index], (uint16_t)(mDepth + 1), index };
+	}
+
+	// Получение значения, глубины, количества детей и индекса этого лепестка.
+
+	T GetValue() const
+	{
+		return mDag->mNodes[mNode].value;
+	}
+
+	uint16_t GetDepth() const
+	{
+		return mDepth;
+	}
+
+	uint16_t GetChildAmount() const
+	{
+		return mDag->mNodes[mNode].childrenAmount;
+	}
+
+	uint16_t GetChildIndex() const
+	{
+		return mChildIndex;
+	}
+
+	// Номер общего узла: у одинаковых поддеревьев он одинаковый.
+	uint32_t GetNode() const
+	{
+		return mNode;
+	}
+
+	// Количество лепестков в поддереве этого лепестка, включая его самого, за O(1).
+	uint64_t GetLeafAmount() const
+	{
+		return mDag->mNodes[mNode].leafAmount;
+	}
+private:
+	NDagLeaf(const NDag<T, N>* dag, uint32_t node, uint16_t depth, uint16_t childIndex)
+	{
+		mDag = dag;
+		mNode = node;
+		mDepth = depth;
+		mChildIndex = childIndex;
+	}
+};
+
+/*
+	Дерево со сжатием одинаковых поддеревьев (hash-consing).
+
+	Одинаковые по структуре и значениям поддеревья хранятся один раз, а дерево превращается
+	в ориентированный ациклический граф общих узлов. Одинаковые поддеревья находятся по
+	хэшу NLeaf::GetHash и сверяются точно: значение и номера уже общих потомков.
+	На деревьях с повторяющимися поддеревьями (сгенерированные деревья, однотипные
+	иерархии) узлов становится во много раз меньше, чем лепестков.
+
+	Дерево только для чтения: Walk и GetNChild ведут себя как у NLeaf, но отдают NDagLeaf.
+	Serialize сохраняет сам граф, а не развёрнутое дерево.
+*/
+template<typename T, uint16_t N>
+class NDag
+{
+	friend class NDagLeaf<T, N>;
+public:
+	using walk_callback_t = std::function<bool(const NDagLeaf<T, N>&)>;
+private:
+	// Общий узел. Потомки узла всегда имеют меньшие номера, чем он сам.
+	struct dag_node_t
+	{
+		T value;
+		uint16_t childrenAmount;
+		uint32_t children[N];
+
+		// Размер развёрнутого поддерева.
+		uint64_t leafAmount;
+	};
+
+	std::vector<dag_node_t> mNodes;
+
+	uint32_t mRoot = 0;
+public:
+	/*
+		Построение графа из дерева. Хэши поддеревьев берутся из кэша лепестков,
+		устаревшие пересчитываются в threads потоков (см. NLeaf::GetHash).
+	*/
+	static NDag<T, N> FromTree(NLeaf<T, N>* tree, uint16_t threads = 1)
+	{
+		NDag<T, N> result;
+
+		tree->GetHash(threads);
+
+		std::vector<NLeaf<T, N>*> leaves = {};
+		tree->Walk([&](NLeaf<T, N>* leaf) -> bool {
+			leaves.push_back(leaf);
+
+			return false;
+		});
+
+		// Номер общего узла для каждого лепестка и узлы с одинаковым хэшем.
+		std::unordered_map<const NLeaf<T, N>*, uint32_t> nodeOf = {};
+		nodeOf.reserve(leaves.size());
+
+		std::unordered_multimap<uint64_t, uint32_t> nodesByHash = {};
+
+		// С конца обхода в ширину потомки получают номера раньше родителей.
+		for (size_t l = leaves.size(); l > 0; l--)
+		{
+			NLeaf<T, N>* leaf = leaves[l - 1];
+
+			dag_node_t node = {};
+			node.value = leaf->GetValue();
+			node.leafAmount = 1;
+
+			for (uint16_t c = 0; c < leaf->GetChildAmount(); c++)
+			{
+				NLeaf<T, N>* child = *leaf->GetNChild(c);
+				if (child != nullptr)
+				{
+					uint32_t childNode = nodeOf[child];
+
+					node.children[node.childrenAmount++] = childNode;
+					node.leafAmount += result.mNodes[childNode].leafAmount;
+				}
+			}
+
+			uint64_t hash = leaf->GetHash();
+
+			uint32_t found = (uint32_t)result.mNodes.size();
+
+			auto range = nodesByHash.equal_range(hash);
+			for (auto it = range.first; it != range.second; it++)
+			{
+				if (Same(result.mNodes[it->second], node))
+				{
+					found = it->second;
+					break;
+				}
+			}
+
+			if (found == result.mNodes.size())
+			{
+				result.mNodes.push_back(node);
+				nodesByHash.insert({ hash, found });
+			}
+
+			nodeOf[leaf] = found;
+		}
+
+		result.mRoot = nodeOf[tree];
+
+		return result;
+	}
+public:
+	NDagLeaf<T, N> GetRoot() const
+	{
+		return { this, mRoot, 0, 0 };
+	}
+
+	// Количество общих узлов.
+	size_t GetNodeAmount() const
+	{
+		return mNodes.size();
+	}
+
+	// Количество лепестков развёрнутого дерева.
+	uint64_t GetLeafAmount() const
+	{
+		return (mNodes.size() > 0) ? mNodes[mRoot].leafAmount : 0;
+	}
+
+	// Объём памяти под узлы графа.
+	size_t GetByteSize() const
+	{
+		return mNodes.size() * sizeof(dag_node_t);
+	}
+
+	// Итерация в ширину по развёрнутому дереву как NLeaf::Walk: по всему дереву или по поддереву from.
+	void Walk(walk_callback_t walker) const
+	{
+		if (mNodes.size() > 0)
+		{
+			Walk(walker, GetRoot());
+		}
+	}
+
+	void Walk(walk_callback_t walker, const NDagLeaf<T, N>& from) const
+	{
+		std::deque<NDagLeaf<T, N>> collected = {};
+		collected.push_back(from);
+
+		while (collected.size() > 0)
+		{
+			NDagLeaf<T, N> leaf = collected.front();
+			collected.pop_front();
+
+			for (uint16_t c = 0; c < leaf.GetChildAmount(); c++)
+			{
+				collected.push_back(leaf.GetNChild(c));
+			}
+
+			if (walker(leaf))
+			{
+				break;
+			}
+		}
+	}
+
+	// Развёртывание обратно в обычное дерево.
+	NLeaf<T, N>* ToTree() const
+	{
+		NLeaf<T, N>* result = nullptr;
+
+		std::queue<std::pair<NDagLeaf<T, N>, leaf_generation_data_t<T, N>>> toPopulate = {};
+		toPopulate.push({ GetRoot(), { &result, nullptr, 0 } });
+
+		while (toPopulate.size() > 0)
+		{
+			const NDagLeaf<T, N>& leaf = toPopulate.front().first;
+			const leaf_generation_data_t<T, N>& leafData = toPopulate.front().second;
+
+			(*leafData.output) = new NLeaf<T, N>(leaf.GetValue());
+
+			if (leafData.parent != nullptr)
+			{
+				leafData.parent->SetNChild(leafData.childIndex, (*leafData.output));
+			}
+
+			for (uint16_t c = 0; c < leaf.GetChildAmount(); c++)
+			{
+				toPopulate.push({ leaf.GetNChild(c), { (*leafData.output)->GetNChild(c), (*leafData.output), c } });
+			}
+
+			toPopulate.pop();
+		}
+
+		return result;
+	}
+
+	/*
+		Сохранение самого графа. Первая строка - количество узлов и номер корня, дальше
+		по строке на узел: "количество_детей номера_детей... :значение". Потомки всегда
+		записаны раньше родителей.
+	*/
+	void Serialize(std::ostream& stream) const
+	{
+		stream << mNodes.size() << " " << mRoot << std::endl;
+
+		for (const dag_node_t& node : mNodes)
+		{
+			stream << node.childrenAmount;
+
+			for (uint16_t c = 0; c < node.childrenAmount; c++)
+			{
+				stream << " " << node.children[c];
+			}
+
+			stream << " :" << node.value << std::endl;
+		}
+	}
+
+	/*
+		Чтение графа, сохранённого через Serialize. Если количество детей больше N, номер потомка
+		не указывает на уже прочитанный узел, номер корня вне графа или узлов меньше, чем
+		объявлено, то возвращается пустой граф.
+	*/
+	static NDag<T, N> Deserialize(std::istream& stream, typename NLeaf<T, N>::deserializer_t valueDeserializer)
+	{
+		NDag<T, N> result;
+
+		std::string curline = "";
+		if (!std::getline(stream, curline))
+		{
+			return result;
+		}
+
+		// Количество узлов не резервируется заранее: до конца чтения ему нельзя доверять.
+		size_t nodeAmount = 0;
+		if (!(std::istringstream(curline) >> nodeAmount >> result.mRoot))
+		{
+			return NDag<T, N>();
+		}
+
+		while (result.mNodes.size() < nodeAmount && std::getline(stream, curline))
+		{
+			size_t delimiterPos = curline.find(':');
+			if (delimiterPos == std::string::npos)
+			{
+				continue;
+			}
+
+			std::istringstream header(curline.substr(0, delimiterPos));
+
+			dag_node_t node = {};
+			node.leafAmount = 1;
+
+			if (!(header >> node.childrenAmount) || node.childrenAmount > N)
+			{
+				return NDag<T, N>();
+			}
+
+			for (uint16_t c = 0; c < node.childrenAmount; c++)
+			{
+				// Потомки записаны раньше родителей, поэтому номер потомка меньше номера узла.
+				if (!(header >> node.children[c]) || node.children[c] >= result.mNodes.size())
+				{
+					return NDag<T, N>();
+				}
+
+				node.leafAmount += result.mNodes[node.children[c]].leafAmount;
+			}
+
+			node.value = valueDeserializer(curline.substr(delimiterPos + 1));
+
+			result.mNodes.push_back(node);
+		}
+
+		if (result.mNodes.size() != nodeAmount || result.mRoot >= nodeAmount)
+		{
+			return NDag<T, N>();
+		}
+
+		return result;
+	}
+private:
+	// Точное сравнение узлов: потомки уже общие, поэтому достаточно сравнить их номера.
+	static bool Same(const dag_node_t& a, const dag_node_t& b)
+	{
+		if (!(a.value == b.value) || a.childrenAmount != b.childrenAmount)
+		{
+			return false;
+		}
+
+		for (uint16_t c = 0; c < a.childrenAmount; c++)
+		{
+			if (a.children[c] != b.children[c])
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+};
@@ -0,0 +1,444 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ntree.hpp"
+
+/*
+	Структурная разница между двумя деревьями и её применение.
+
+	Потомки сравниваются по позиции среди непустых слотов: пустые слоты (после ReplaceNChild)
+	пропускаются так же, как в Walk, а пути в операциях - это индексы слотов старого дерева.
+	Для каждой пары лепестков с одинаковым путём
+	записывается новое значение, если оно изменилось; лишние потомки старого дерева
+	удаляются с конца, недостающие добавляются целыми поддеревьями. Поддеревья с
+	одинаковым хэшем считаются одинаковыми и не обходятся вовсе, поэтому время
+	сравнения зависит в основном от размера изменившихся областей, а повторное сравнение
+	после правок пересчитывает хэши только на путях к изменённым лепесткам.
+
+	Результат - NPatch, который можно сохранить в поток, передать и применить к копии
+	старого дерева, не пересылая всё новое дерево.
+*/
+template<typename T, uint16_t N>
+class NPatch
+{
+public:
+	// Путь к лепестку: индексы потомков от корня. Пустой путь - сам корень.
+	using path_t = std::vector<uint16_t>;
+
+	// Лепесток добавляемого поддерева в порядке обхода в ширину: количество детей и значение.
+	using subtree_leaf_t = std::pair<uint16_t, T>;
+private:
+	// Вид операции.
+	enum operation_kind_t : char
+	{
+		OPERATION_SET_VALUE = 'S',
+		OPERATION_REMOVE = 'R',
+		OPERATION_ATTACH = 'A'
+	};
+
+	// Операция патча.
+	struct operation_t
+	{
+		operation_kind_t kind;
+
+		// Для установки значения - путь к лепестку, для удаления - путь к удаляемому лепестку,
+		// для добавления - путь к родителю.
+		path_t path;
+
+		T value;
+
+		// Добавляемое поддерево (только для добавления).
+		std::vector<subtree_leaf_t> subtree;
+	};
+
+	std::vector<operation_t> mOperations;
+public:
+	/*
+		Построение патча, превращающего дерево from в дерево to.
+		Деревья во время сравнения не должны меняться. Хэши поддеревьев берутся из кэша
+		лепестков (NLeaf::GetHash), устаревшие пересчитываются в threads потоков.
+	*/
+	static NPatch<T, N> Diff(NLeaf<T, N>* from, NLeaf<T, N>* to, uint16_t threads = 1)
+	{
+		NPatch<T, N> result;
+
+		from->GetHash(threads);
+		to->GetHash(threads);
+
+		// Пары лепестков с одинаковым путём, которые ещё предстоит сравнить.
+		struct compare_data_t
+		{
+			NLeaf<T, N>* from;
+			NLeaf<T, N>* to;
+			path_t path;
+		};
+
+		std::vector<compare_data_t> toCompare = {};
+		toCompare.push_back({ from, to, {} });
+
+		while (toCompare.size() > 0)
+		{
+			compare_data_t data = std::move(toCompare.back());
+			toCompare.pop_back();
+
+			if (data.from->GetHash() == data.to->GetHash() && Equal(data.from, data.to))
+			{
+				continue;
+			}
+
+			if (!(data.from->GetValue() == data.to->GetValue()))
+			{
+				result.mOperations.push_back({ OPERATION_SET_VALUE, data.path, data.to->GetValue(), {} });
+			}
+
+			// Индексы непустых слотов: по ним потомки сопоставляются и адресуются.
+			std::vector<uint16_t> fromSlots = GetSlots(data.from);
+			std::vector<uint16_t> toSlots = GetSlots(data.to);
+			size_t commonAmount = (fromSlots.size() < toSlots.size()) ? fromSlots.size() : toSlots.size();
+
+			for (size_t c = 0; c < commonAmount; c++)
+			{
+				path_t path = data.path;
+				path.push_back(fromSlots[c]);
+
+				toCompare.push_back({ *data.from->GetNChild(fromSlots[c]), *data.to->GetNChild(toSlots[c]), std::move(path) });
+			}
+
+			// Лишних потомков удаляем с конца, чтобы индексы оставшихся не сдвигались.
+			for (size_t c = fromSlots.size(); c > commonAmount; c--)
+			{
+				path_t path = data.path;
+				path.push_back(fromSlots[c - 1]);
+
+				result.mOperations.push_back({ OPERATION_REMOVE, std::move(path), T(), {} });
+			}
+
+			for (size_t c = commonAmount; c < toSlots.size(); c++)
+			{
+				operation_t operation = { OPERATION_ATTACH, data.path, T(), {} };
+
+				// Количество детей - только непустые слоты, как их и обходит Walk.
+				(*data.to->GetNChild(toSlots[c]))->Walk([&](NLeaf<T, N>* leaf) -> bool {
+					operation.subtree.push_back({ (uint16_t)GetSlots(leaf).size(), leaf->GetValue() });
+
+					return false;
+				});
+
+				result.mOperations.push_back(std::move(operation));
+			}
+		}
+
+		return result;
+	}
+
+	// Построение патча между двумя сериализованными деревьями (формат NLeaf::Serialize).
+	static NPatch<T, N> Diff(std::istream& from, std::istream& to, typename NLeaf<T, N>::deserializer_t valueDeserializer, uint16_t threads = 1)
+	{
+		NLeaf<T, N>* fromTree = nullptr;
+		NLeaf<T, N>* toTree = nullptr;
+
+		NLeaf<T, N>::Deserialize(from, &fromTree, valueDeserializer);
+		NLeaf<T, N>::Deserialize(to, &toTree, valueDeserializer);
+
+		NPatch<T, N> result = Diff(fromTree, toTree, threads);
+
+		delete fromTree;
+		delete toTree;
+
+		return result;
+	}
+public:
+	// Количество операций в патче.
+	size_t GetSize() const
+	{
+		return mOperations.size();
+	}
+
+	/*
+		Применение патча к дереву tree, которое должно совпадать с деревом from из Diff.
+		Возвращает количество применённых операций: операции с несуществующим путём пропускаются.
+	*/
+	size_t Apply(NLeaf<T, N>* tree) const
+	{
+		size_t applied = 0;
+
+		for (const operation_t& operation : mOperations)
+		{
+			size_t pathLength = operation.path.size();
+			if (operation.kind == OPERATION_REMOVE)
+			{
+				if (pathLength <= 0)
+				{
+					continue;
+				}
+
+				pathLength--;
+			}
+
+			NLeaf<T, N>* leaf = Follow(tree, operation.path, pathLength);
+			if (leaf == nullptr)
+			{
+				continue;
+			}
+
+			switch (operation.kind)
+			{
+			case OPERATION_SET_VALUE:
+				leaf->SetValue(operation.value);
+				applied++;
+				break;
+			case OPERATION_REMOVE:
+				if (operation.path.back() < leaf->GetChildAmount())
+				{
+					leaf->RemoveNChild(operation.path.back());
+					applied++;
+				}
+				break;
+			case OPERATION_ATTACH:
+				if (leaf->GetChildAmount() < N && operation.subtree.size() > 0)
+				{
+					leaf->GraftNChild(BuildSubtree(operation.subtree));
+					applied++;
+				}
+				break;
+			}
+		}
+
+		return applied;
+	}
+
+	/*
+		Сохранение патча в поток. Каждая операция - строка "вид длина_пути индексы... :значение";
+		у добавления вместо значения стоит количество лепестков поддерева, а следом идут
+		сами лепестки в формате NLeaf::Serialize.
+	*/
+	void Serialize(std::ostream& stream) const
+	{
+		for (const operation_t& operation : mOperations)
+		{
+			stream << (char)operation.kind << " " << operation.path.size();
+
+			for (uint16_t index : operation.path)
+			{
+				stream << " " << index;
+			}
+
+			stream << " :";
+
+			switch (operation.kind)
+			{
+			case OPERATION_SET_VALUE:
+				stream << operation.value << std::endl;
+				break;
+			case OPERATION_REMOVE:
+				stream << std::endl;
+				break;
+			case OPERATION_ATTACH:
+				stream << operation.subtree.size() << std::endl;
+
+				for (const subtree_leaf_t& leaf : operation.subtree)
+				{
+					stream << leaf.first << ":" << leaf.second << std::endl;
+				}
+				break;
+			}
+		}
+	}
+
+	/*
+		Чтение патча, сохранённого через Serialize. Патч может прийти из сети, поэтому при любом
+		неразборчивом поле, неизвестном виде операции, количестве детей больше N или поддереве,
+		которое не сходится со своим количеством лепестков, возвращается пустой патч.
+	*/
+	static NPatch<T, N> Deserialize(std::istream& stream, typename NLeaf<T, N>::deserializer_t valueDeserializer)
+	{
+		NPatch<T, N> result;
+
+		std::string curline = "";
+		while (std::getline(stream, curline))
+		{
+			if (curline.empty())
+			{
+				continue;
+			}
+
+			size_t delimiterPos = curline.find(':');
+			if (delimiterPos == std::string::npos)
+			{
+				return NPatch<T, N>();
+			}
+
+			std::istringstream header(curline.substr(0, delimiterPos));
+			std::string valueString = curline.substr(delimiterPos + 1);
+
+			operation_t operation = { OPERATION_SET_VALUE, {}, T(), {} };
+
+			char kind = 0;
+			size_t pathLength = 0;
+
+			// Каждый индекс пути занимает в строке хотя бы два символа, поэтому длина пути не больше длины строки.
+			if (!(header >> kind >> pathLength) || pathLength > curline.size())
+			{
+				return NPatch<T, N>();
+			}
+
+			operation.kind = (operation_kind_t)kind;
+			operation.path.resize(pathLength);
+
+			for (size_t p = 0; p < pathLength; p++)
+			{
+				header >> operation.path[p];
+			}
+
+			if (header.fail())
+			{
+				return NPatch<T, N>();
+			}
+
+			switch (operation.kind)
+			{
+			case OPERATION_SET_VALUE:
+				operation.value = valueDeserializer(valueString);
+				break;
+			case OPERATION_REMOVE:
+				break;
+			case OPERATION_ATTACH:
+				{
+					uint64_t amount = 0;
+					if (!ParseNumber(valueString, amount) || amount <= 0)
+					{
+						return NPatch<T, N>();
+					}
+
+					// Количеству лепестков нельзя доверять, пока они не прочитаны, поэтому место не резервируется.
+					uint64_t childAmount = 0;
+
+					for (uint64_t l = 0; l < amount && std::getline(stream, curline); l++)
+					{
+						size_t leafDelimiterPos = curline.find(':');
+
+						uint64_t children = 0;
+						if (leafDelimiterPos == std::string::npos || !ParseNumber(curline.substr(0, leafDelimiterPos), children) || children > N)
+						{
+							return NPatch<T, N>();
+						}
+
+						childAmount += children;
+						operation.subtree.push_back({ (uint16_t)children, valueDeserializer(curline.substr(leafDelimiterPos + 1)) });
+					}
+
+					// В обходе в ширину у каждого лепестка, кроме корня, ровно один родитель.
+					if (operation.subtree.size() != amount || childAmount != amount - 1)
+					{
+						return NPatch<T, N>();
+					}
+				}
+				break;
+			default:
+				return NPatch<T, N>();
+			}
+
+			result.mOperations.push_back(std::move(operation));
+		}
+
+		return result;
+	}
+private:
+	/*
+		Проверка, что поддеревья с одинаковым хэшем действительно равны. Для совпавших
+		хэшей сравниваются только значения и количества детей корней: вероятность
+		коллизии 64-битного хэша пренебрежимо мала.
+	*/
+	static bool Equal(NLeaf<T, N>* from, NLeaf<T, N>* to)
+	{
+		return from->GetValue() == to->GetValue() && from->GetChildAmount() == to->GetChildAmount();
+	}
+
+	// Индексы непустых слотов потомков лепестка по возрастанию.
+	static std::vector<uint16_t> GetSlots(NLeaf<T, N>* leaf)
+	{
+		std::vector<uint16_t> slots = {};
+
+		for (uint16_t c = 0; c < leaf->GetChildAmount(); c++)
+		{
+			if (*leaf->GetNChild(c) != nullptr)
+			{
+				slots.push_back(c);
+			}
+		}
+
+		return slots;
+	}
+
+	// Лепесток по первым length индексам пути или nullptr, если такого пути нет или он ведёт в пустой слот.
+	static NLeaf<T, N>* Follow(NLeaf<T, N>* tree, const path_t& path, size_t length)
+	{
+		NLeaf<T, N>* leaf = tree;
+
+		for (size_t p = 0; p < length && leaf != nullptr; p++)
+		{
+			if (path[p] >= leaf->GetChildAmount())
+			{
+				return nullptr;
+			}
+
+			leaf = *leaf->GetNChild(path[p]);
+		}
+
+		return leaf;
+	}
+
+	// Разбор неотрицательного десятичного числа, занимающего всю строку (пробелы по краям допускаются).
+	static bool ParseNumber(const std::string& text, uint64_t& number)
+	{
+		std::istringstream input(text);
+		input >> std::ws;
+
+		if (input.peek() < '0' || input.peek() > '9' || !(input >> number))
+		{
+			return false;
+		}
+
+		input >> std::ws;
+
+		return input.eof();
+	}
+
+	// Построение поддерева из лепестков в порядке обхода в ширину.
+	static NLeaf<T, N>* BuildSubtree(const std::vector<subtree_leaf_t>& subtree)
+	{
+		NLeaf<T, N>* result = nullptr;
+
+		std::queue<leaf_generation_data_t<T, N>> toPopulate = {};
+		toPopulate.push({ &result, nullptr, 0 });
+
+		for (size_t l = 0; l < subtree.size() && toPopulate.size() > 0; l++)
+		{
+			const leaf_generation_data_t<T, N>& leafData = toPopulate.front();
+			(*leafData.output) = new NLeaf<T, N>(subtree[l].second);
+
+			if (leafData.parent != nullptr)
+			{
+				leafData.parent->SetNChild(leafData.childIndex, (*leafData.output));
+			}
+
+			for (uint16_t c = 0; c < subtree[l].first; c++)
+			{
+				toPopulate.push({ (*leafData.output)->GetNChild(c), (*leafData.output), c });
+			}
+
+			toPopulate.pop();
+		}
+
+		return result;
+	}
+};
@@ -0,0 +1,282 @@
+﻿#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "ntree.hpp"
+
+/*
+	Потоковая выгрузка дерева в Graphviz DOT и GraphML для внешних инструментов анализа.
+
+	Обход идёт в глубину по указателям на родителя, без очереди и без стека, поэтому
+	дополнительная память не зависит от размера дерева: это один буфер вывода фиксированного
+	размера, который целиком сбрасывается в поток при заполнении. Числа форматируются через
+	std::to_chars прямо в буфер, строки на каждый лепесток не создаются. Идентификаторы
+	лепестков строятся из их адресов, поэтому для рёбер не нужно помнить номера родителей.
+
+	Выгружается поддерево лепестка root. maxDepth ограничивает глубину от root (-1 - без
+	ограничения), filter, если задан, отбрасывает лепесток вместе со всем его поддеревом.
+*/
+template<typename T, uint16_t N>
+class NExporter
+{
+public:
+	// Фильтр поддеревьев: false - пропустить лепесток и всех его потомков.
+	using filter_t = std::function<bool(NLeaf<T, N>*)>;
+private:
+	// Размер буфера вывода.
+	static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+	// Как экранировать строковые значения.
+	enum escape_t : uint8_t
+	{
+		ESCAPE_DOT,
+		ESCAPE_XML
+	};
+
+	std::ostream& mStream;
+
+	std::vector<char> mBuffer;
+	size_t mUsed = 0;
+
+	// Для значений, которые нельзя вывести через to_chars. Переиспользуется между лепестками.
+	std::ostringstream mValueStream;
+public:
+	// Выгрузка в DOT: "digraph" с вершиной на лепесток (подпись - значение) и ребром на каждую связь.
+	static void ExportDot(NLeaf<T, N>* root, std::ostream& stream, uint16_t maxDepth = -1, filter_t filter = nullptr)
+	{
+		NExporter<T, N> exporter(stream);
+
+		exporter.Write("digraph NTree {\n\tnode [shape=box];\n");
+
+		Visit(root, maxDepth, filter, [&](NLeaf<T, N>* leaf, uint16_t) {
+			exporter.Write("\t");
+			exporter.WriteId(leaf);
+			exporter.Write(" [label=\"");
+			exporter.WriteValue(leaf->GetValue(), ESCAPE_DOT);
+			exporter.Write("\"];\n");
+		}, [&](NLeaf<T, N>* parent, NLeaf<T, N>* child) {
+			exporter.Write("\t");
+			exporter.WriteId(parent);
+			exporter.Write(" -> ");
+			exporter.WriteId(child);
+			exporter.Write(";\n");
+		});
+
+		exporter.Write("}\n");
+		exporter.Flush();
+	}
+
+	// Выгрузка в GraphML: значение и глубина от root лежат в атрибутах value и depth каждой вершины.
+	static void ExportGraphML(NLeaf<T, N>* root, std::ostream& stream, uint16_t maxDepth = -1, filter_t filter = nullptr)
+	{
+		NExporter<T, N> exporter(stream);
+
+		exporter.Write(
+			"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+			"<graphml xmlns=\"http://graphml.graphdrawing.org/xmlns\">\n"
+			"\t<key id=\"value\" for=\"node\" attr.name=\"value\" attr.type=\"string\"/>\n"
+			"\t<key id=\"depth\" for=\"node\" attr.name=\"depth\" attr.type=\"int\"/>\n"
+			"\t<graph id=\"NTree\" edgedefault=\"directed\">\n");
+
+		Visit(root, maxDepth, filter, [&](NLeaf<T, N>* leaf, uint16_t depth) {
+			exporter.Write("\t\t<node id=\"");
+			exporter.WriteId(leaf);
+			exporter.Write("\"><data key=\"value\">");
+			exporter.WriteValue(leaf->GetValue(), ESCAPE_XML);
+			exporter.Write("</data><data key=\"depth\">");
+			exporter.WriteNumber(depth);
+			exporter.Write("</data></node>\n");
+		}, [&](NLeaf<T, N>* parent, NLeaf<T, N>* child) {
+			exporter.Write("\t\t<edge source=\"");
+			exporter.WriteId(parent);
+			exporter.Write("\" target=\"");
+			exporter.WriteId(child);
+			exporter.Write("\"/>\n");
+		});
+
+		exporter.Write("\t</graph>\n</graphml>\n");
+		exporter.Flush();
+	}
+private:
+	NExporter(std::ostream& stream) : mStream(stream)
+	{
+		mBuffer.resize(BUFFER_SIZE);
+	}
+
+	/*
+		Прямой обход в глубину за O(1) памяти: вниз - к первому подходящему потомку, а если его
+		нет, то вверх по mParent до первого предка, у которого есть следующий подходящий потомок.
+		onLeaf(лепесток, глубина) вызывается на каждый выгружаемый лепесток, onEdge(родитель, потомок) - на каждое ребро.
+	*/
+	template<typename L, typename E>
+	static void Visit(NLeaf<T, N>* root, uint16_t maxDepth, const filter_t& filter, L onLeaf, E onEdge)
+	{
+		if (filter && !filter(root))
+		{
+			return;
+		}
+
+		NLeaf<T, N>* leaf = root;
+		uint16_t depth = 0;
+
+		onLeaf(leaf, depth);
+
+		while (true)
+		{
+			NLeaf<T, N>* next = (depth < maxDepth) ? FindChild(leaf, 0, filter) : nullptr;
+
+			if (next != nullptr)
+			{
+				onEdge(leaf, next);
+
+				leaf = next;
+				depth++;
+
+				onLeaf(leaf, depth);
+				continue;
+			}
+
+			// Подъём до предка со следующим подходящим потомком.
+			while (leaf != root)
+			{
+				NLeaf<T, N>* parent = leaf->GetParent();
+				NLeaf<T, N>* sibling = FindChild(parent, leaf->GetChildIndex() + 1, filter);
+
+				if (sibling != nullptr)
+				{
+					onEdge(parent, sibling);
+
+					leaf = sibling;
+
+					onLeaf(leaf, depth);
+					break;
+				}
+
+				leaf = parent;
+				depth--;
+			}
+
+			if (leaf == root)
+			{
+				break;
+			}
+		}
+	}
+
+	// Первый непустой потомок leaf, начиная с индекса from, который пропускает filter.
+	static NLeaf<T, N>* FindChild(NLeaf<T, N>* leaf, uint16_t from, const filter_t& filter)
+	{
+		for (uint16_t c = from; c < leaf->GetChildAmount(); c++)
+		{
+			NLeaf<T, N>* child = *leaf->GetNChild(c);
+
+			if (child != nullptr && (!filter || filter(child)))
+			{
+				return child;
+			}
+		}
+
+		return nullptr;
+	}
+private:
+	// Запись в буфер. Буфер сбрасывается в поток целиком, когда следующая запись в него не помещается.
+
+	void Write(std::string_view text)
+	{
+		if (mUsed + text.size() > mBuffer.size())
+		{
+			Flush();
+
+			if (text.size() > mBuffer.size())
+			{
+				mStream.write(text.data(), text.size());
+
+				return;
+			}
+		}
+
+		memcpy(mBuffer.data() + mUsed, text.data(), text.size());
+		mUsed += text.size();
+	}
+
+	void WriteNumber(uint64_t number)
+	{
+		char digits[24];
+		std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), number);
+
+		Write(std::string_view(digits, result.ptr - digits));
+	}
+
+	// Идентификатор лепестка: "n" и адрес в шестнадцатеричном виде.
+	void WriteId(const NLeaf<T, N>* leaf)
+	{
+		char digits[24] = { 'n' };
+		std::to_chars_result result = std::to_chars(digits + 1, digits + sizeof(digits), (uintptr_t)leaf, 16);
+
+		Write(std::string_view(digits, result.ptr - digits));
+	}
+
+	void WriteValue(const T& value, escape_t escape)
+	{
+		// Числа не нуждаются в экранировании и пишутся прямо в буфер.
+		if constexpr (std::is_arithmetic_v<T> && !std::is_same_v<T, bool> && !std::is_same_v<T, char>)
+		{
+			char digits[64];
+			std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), value);
+
+			Write(std::string_view(digits, result.ptr - digits));
+		}
+		else
+		{
+			mValueStream.str("");
+			mValueStream << value;
+
+			std::string text = mValueStream.str();
+
+			for (char symbol : text)
+			{
+				WriteEscaped(symbol, escape);
+			}
+		}
+	}
+
+	void WriteEscaped(char symbol, escape_t escape)
+	{
+		if (escape == ESCAPE_DOT)
+		{
+			switch (symbol)
+			{
+			case '"': Write("\\\""); return;
+			case '\\': Write("\\\\"); return;
+			case '\n': Write("\\n"); return;
+			}
+		}
+		else
+		{
+			switch (symbol)
+			{
+			case '&': Write("&amp;"); return;
+			case '<': Write("&lt;"); return;
+			case '>': Write("&gt;"); return;
+			case '"': Write("&quot;"); return;
+			}
+		}
+
+		Write(std::string_view(&symbol, 1));
+	}
+
+	void Flush()
+	{
+		mStream.write(mBuffer.data(), mUsed);
+		mUsed = 0;
+	}
+};
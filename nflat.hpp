@@ -0,0 +1,416 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <type_traits>
+#include <vector>
+
+#include "ntree.hpp"
+#include "nutility.hpp"
+
+/*
+	Плоское неизменяемое дерево в одном непрерывном буфере без указателей.
+
+	Лепестки пронумерованы в порядке обхода в ширину, поэтому потомки любого лепестка
+	идут подряд: потомки лепестка i - это лепестки с номерами от offsets[i] + 1 до offsets[i + 1]
+	включительно. Все массивы лежат в буфере по смещениям из заголовка, поэтому буфер можно
+	как есть положить в файл, в разделяемую память или отобразить через mmap и сразу читать.
+*/
+template<typename T>
+class NFlatTree
+{
+	static_assert(std::is_trivially_copyable_v<T>, "NFlatTree хранит значения побайтово, T должен быть тривиально копируемым");
+public:
+	// Номер несуществующего лепестка (родитель корня).
+	static constexpr uint64_t INVALID_LEAF = UINT64_MAX;
+
+	// Callback итерации. Смысл возвращаемого значения такой же, как в NLeaf::Walk.
+	using walk_callback_t = std::function<bool(uint64_t)>;
+private:
+	// Заголовок буфера. Все смещения - от начала буфера.
+	struct flat_header_t
+	{
+		uint64_t magic;
+		uint64_t valueSize;
+		uint64_t leafAmount;
+		uint64_t byteSize;
+
+		uint64_t valuesOffset;
+		uint64_t offsetsOffset;
+		uint64_t parentsOffset;
+		uint64_t depthsOffset;
+	};
+
+	// Версия 2: глубины хранятся в uint32_t, буферы версии 1 с глубинами в uint16_t не открываются.
+	static constexpr uint64_t FLAT_MAGIC = 0x3265657274746e46; // "Fnttree2"
+
+	// Собственный буфер, если дерево им владеет. Для представлений поверх чужой памяти пуст.
+	std::vector<uint64_t> mStorage;
+
+	// Начало буфера.
+	const uint8_t* mData = nullptr;
+
+	// Указатели на массивы внутри буфера.
+	const flat_header_t* mHeader = nullptr;
+	const T* mValues = nullptr;
+	const uint64_t* mOffsets = nullptr;
+	const uint64_t* mParents = nullptr;
+	const uint32_t* mDepths = nullptr;
+public:
+	NFlatTree() = default;
+
+	// При копировании и перемещении указатели на массивы нужно перенастроить на новый буфер.
+
+	NFlatTree(const NFlatTree& other)
+	{
+		*this = other;
+	}
+
+	NFlatTree(NFlatTree&& other) noexcept
+	{
+		*this = std::move(other);
+	}
+
+	NFlatTree& operator=(const NFlatTree& other)
+	{
+		mStorage = other.mStorage;
+		Bind((mStorage.size() > 0) ? reinterpret_cast<const uint8_t*>(mStorage.data()) : other.mData);
+
+		return *this;
+	}
+
+	NFlatTree& operator=(NFlatTree&& other) noexcept
+	{
+		const uint8_t* data = other.mData;
+		bool owned = other.mStorage.size() > 0;
+
+		mStorage = std::move(other.mStorage);
+		Bind(owned ? reinterpret_cast<const uint8_t*>(mStorage.data()) : data);
+
+		return *this;
+	}
+public:
+	/*
+		Представление поверх готового буфера (из файла, mmap или разделяемой памяти) без копирования.
+		Буфер должен жить дольше представления. Если заголовок не подходит, то возвращается пустое дерево.
+	*/
+	static NFlatTree<T> View(const void* data)
+	{
+		NFlatTree<T> result;
+
+		const flat_header_t* header = static_cast<const flat_header_t*>(data);
+		if (header->magic == FLAT_MAGIC && header->valueSize == sizeof(T))
+		{
+			result.Bind(static_cast<const uint8_t*>(data));
+		}
+
+		return result;
+	}
+
+	/*
+		Представление поверх буфера известного размера byteSize, содержимому которого нельзя доверять
+		(чужой сегмент разделяемой памяти, файл). Заголовок и все массивы должны лежать внутри
+		буфера, иначе возвращается пустое дерево.
+	*/
+	static NFlatTree<T> View(const void* data, uint64_t byteSize)
+	{
+		if (data == nullptr || byteSize < sizeof(flat_header_t))
+		{
+			return NFlatTree<T>();
+		}
+
+		const flat_header_t* header = static_cast<const flat_header_t*>(data);
+		uint64_t size = header->byteSize;
+		uint64_t leafAmount = header->leafAmount;
+
+		// На каждый лепесток приходится хотя бы 8 байт смещения, поэтому произведения ниже не переполняются.
+		bool fits = size <= byteSize && leafAmount < size / sizeof(uint64_t) &&
+			NBufferLayout::Contains(size, sizeof(flat_header_t), header->valuesOffset, leafAmount * sizeof(T)) &&
+			NBufferLayout::Contains(size, sizeof(flat_header_t), header->offsetsOffset, (leafAmount + 1) * sizeof(uint64_t)) &&
+			NBufferLayout::Contains(size, sizeof(flat_header_t), header->parentsOffset, leafAmount * sizeof(uint64_t)) &&
+			NBufferLayout::Contains(size, sizeof(flat_header_t), header->depthsOffset, leafAmount * sizeof(uint32_t));
+
+		return fits ? View(data) : NFlatTree<T>();
+	}
+
+	// Построение плоского дерева из обычного в порядке обхода в ширину.
+	template<uint16_t N>
+	static NFlatTree<T> FromTree(NLeaf<T, N>* tree)
+	{
+		uint64_t leafAmount = 0;
+		tree->Walk([&](NLeaf<T, N>* leaf) -> bool {
+			leafAmount++;
+
+			return false;
+		});
+
+		NFlatTree<T> result;
+		result.Allocate(leafAmount);
+
+		T* values = const_cast<T*>(result.mValues);
+		uint64_t* offsets = const_cast<uint64_t*>(result.mOffsets);
+		uint64_t* parents = const_cast<uint64_t*>(result.mParents);
+		uint32_t* depths = const_cast<uint32_t*>(result.mDepths);
+
+		// Номер лепестка в обходе в ширину и номер последнего уже выданного потомка.
+		uint64_t index = 0;
+		uint64_t lastChild = 0;
+
+		// Номера родителей для лепестков, которые ещё не пройдены: они выдаются в том же порядке, что и Walk.
+		std::queue<uint64_t> parentQueue = {};
+		parentQueue.push(INVALID_LEAF);
+
+		tree->Walk([&](NLeaf<T, N>* leaf) -> bool {
+			values[index] = leaf->GetValue();
+			parents[index] = parentQueue.front();
+			depths[index] = (parents[index] == INVALID_LEAF) ? 0 : depths[parents[index]] + 1;
+			parentQueue.pop();
+
+			offsets[index] = lastChild;
+
+			for (uint16_t c = 0; c < leaf->GetChildAmount(); c++)
+			{
+				if (*leaf->GetNChild(c) != nullptr)
+				{
+					parentQueue.push(index);
+					lastChild++;
+				}
+			}
+
+			index++;
+
+			return false;
+		});
+
+		offsets[leafAmount] = lastChild;
+
+		return result;
+	}
+
+	/*
+		Построение из лепестков, уже пронумерованных в порядке обхода в ширину: parents[i] - номер
+		родителя лепестка i (у корня INVALID_LEAF), values[i] - его значение. Количество детей в
+		дереве не ограничено, глубина - до UINT32_MAX. Если номера не в порядке обхода в ширину
+		(родители лепестков не идут по неубыванию) или дерево глубже, то возвращается пустое дерево.
+	*/
+	static NFlatTree<T> FromBfsOrder(const std::vector<uint64_t>& parents, const std::vector<T>& values)
+	{
+		NFlatTree<T> result;
+
+		uint64_t leafAmount = parents.size();
+		if (leafAmount <= 0 || values.size() != leafAmount || parents[0] != INVALID_LEAF)
+		{
+			return result;
+		}
+
+		for (uint64_t leaf = 1; leaf < leafAmount; leaf++)
+		{
+			if (parents[leaf] >= leaf || (leaf > 1 && parents[leaf] < parents[leaf - 1]))
+			{
+				return result;
+			}
+		}
+
+		result.Allocate(leafAmount);
+
+		T* flatValues = const_cast<T*>(result.mValues);
+		uint64_t* offsets = const_cast<uint64_t*>(result.mOffsets);
+		uint64_t* flatParents = const_cast<uint64_t*>(result.mParents);
+		uint32_t* depths = const_cast<uint32_t*>(result.mDepths);
+
+		// Потомки лепестка i - лепестки с offsets[i] + 1 до offsets[i + 1], поэтому offsets[i] - номер последнего лепестка с родителем меньше i.
+		uint64_t child = 1;
+
+		for (uint64_t leaf = 0; leaf < leafAmount; leaf++)
+		{
+			offsets[leaf] = child - 1;
+
+			while (child < leafAmount && parents[child] == leaf)
+			{
+				child++;
+			}
+
+			// Глубина хранится в uint32_t: более глубокое дерево не представимо.
+			if (leaf > 0 && depths[parents[leaf]] == UINT32_MAX)
+			{
+				return NFlatTree<T>();
+			}
+
+			flatValues[leaf] = values[leaf];
+			flatParents[leaf] = parents[leaf];
+			depths[leaf] = (leaf == 0) ? 0 : depths[parents[leaf]] + 1;
+		}
+
+		offsets[leafAmount] = leafAmount - 1;
+
+		return result;
+	}
+public:
+	// Буфер целиком: его можно записать в файл или разделяемую память и потом открыть через View.
+
+	const void* GetData() const
+	{
+		return mData;
+	}
+
+	uint64_t GetByteSize() const
+	{
+		return (mHeader != nullptr) ? mHeader->byteSize : 0;
+	}
+
+	uint64_t GetLeafAmount() const
+	{
+		return (mHeader != nullptr) ? mHeader->leafAmount : 0;
+	}
+
+	// Доступ к лепесткам по номеру, как у NLeaf.
+
+	T GetValue(uint64_t leaf) const
+	{
+		return mValues[leaf];
+	}
+
+	uint32_t GetDepth(uint64_t leaf) const
+	{
+		return mDepths[leaf];
+	}
+
+	uint64_t GetParent(uint64_t leaf) const
+	{
+		return mParents[leaf];
+	}
+
+	// Количество детей и индексы не ограничены 16 битами, как у NLeaf: у плоского дерева нет N.
+
+	uint64_t GetChildAmount(uint64_t leaf) const
+	{
+		return mOffsets[leaf + 1] - mOffsets[leaf];
+	}
+
+	uint64_t GetNChild(uint64_t leaf, uint64_t index) const
+	{
+		return mOffsets[leaf] + 1 + index;
+	}
+
+	uint64_t GetChildIndex(uint64_t leaf) const
+	{
+		return (leaf == 0) ? 0 : leaf - (mOffsets[mParents[leaf]] + 1);
+	}
+
+	// Прямой доступ к массивам: значения, смещения потомков (leafAmount + 1), родители, глубины.
+
+	const T* GetValues() const
+	{
+		return mValues;
+	}
+
+	const uint64_t* GetOffsets() const
+	{
+		return mOffsets;
+	}
+
+	const uint64_t* GetParents() const
+	{
+		return mParents;
+	}
+
+	const uint32_t* GetDepths() const
+	{
+		return mDepths;
+	}
+public:
+	/*
+		Итерация в ширину по поддереву лепестка from. Так как лепестки уже лежат в порядке
+		обхода в ширину, обход всего дерева - это просто проход по номерам подряд.
+	*/
+	void Walk(walk_callback_t walker, uint64_t from = 0) const
+	{
+		if (GetLeafAmount() == 0)
+		{
+			return;
+		}
+
+		if (from == 0)
+		{
+			for (uint64_t leaf = 0; leaf < GetLeafAmount(); leaf++)
+			{
+				if (walker(leaf))
+				{
+					break;
+				}
+			}
+
+			return;
+		}
+
+		// Потомки каждого уровня поддерева тоже лежат подряд, поэтому уровень - это один диапазон номеров.
+		uint64_t begin = from;
+		uint64_t end = from + 1;
+
+		while (begin < end)
+		{
+			for (uint64_t leaf = begin; leaf < end; leaf++)
+			{
+				if (walker(leaf))
+				{
+					return;
+				}
+			}
+
+			uint64_t nextBegin = mOffsets[begin] + 1;
+			end = mOffsets[end] + 1;
+			begin = nextBegin;
+		}
+	}
+
+	// Сериализация в формате NLeaf::Serialize.
+	void Serialize(std::ostream& stream) const
+	{
+		Walk([&](uint64_t leaf) -> bool {
+			stream << GetChildAmount(leaf) << ":" << GetValue(leaf) << std::endl;
+
+			return false;
+		});
+	}
+private:
+	// Выделение собственного буфера под leafAmount лепестков и раскладка массивов в нём.
+	void Allocate(uint64_t leafAmount)
+	{
+		flat_header_t header = {};
+		header.magic = FLAT_MAGIC;
+		header.valueSize = sizeof(T);
+		header.leafAmount = leafAmount;
+
+		NBufferLayout layout(sizeof(flat_header_t));
+		header.valuesOffset = layout.Add(leafAmount * sizeof(T));
+		header.offsetsOffset = layout.Add((leafAmount + 1) * sizeof(uint64_t));
+		header.parentsOffset = layout.Add(leafAmount * sizeof(uint64_t));
+		header.depthsOffset = layout.Add(leafAmount * sizeof(uint32_t));
+		header.byteSize = layout.GetSize();
+
+		mStorage = layout.Allocate(header);
+
+		Bind(reinterpret_cast<const uint8_t*>(mStorage.data()));
+	}
+
+	// Настройка указателей на массивы по заголовку буфера.
+	void Bind(const uint8_t* data)
+	{
+		mData = data;
+
+		if (data == nullptr)
+		{
+			mHeader = nullptr;
+
+			return;
+		}
+
+		mHeader = reinterpret_cast<const flat_header_t*>(data);
+		mValues = NBufferLayout::At<const T>(data, mHeader->valuesOffset);
+		mOffsets = NBufferLayout::At<const uint64_t>(data, mHeader->offsetsOffset);
+		mParents = NBufferLayout::At<const uint64_t>(data, mHeader->parentsOffset);
+		mDepths = NBufferLayout::At<const uint32_t>(data, mHeader->depthsOffset);
+	}
+};
@@ -0,0 +1,209 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/*
+	Неявная d-арная min-куча с уменьшением приоритета (decrease-key).
+
+	Ключи - номера от 0 до keyAmount - 1 (например, вершины графа), у каждого ключа есть
+	приоритет типа P. Куча лежит одним массивом: потомки элемента i - это элементы
+	с D * i + 1 до D * i + D. Приоритет хранится рядом с ключом, поэтому сравнение потомков
+	читает D соседних элементов подряд, без обращений в другие массивы. По сравнению с
+	двоичной кучей дерево ниже в log2(D) раз: подъём при вставке и уменьшении приоритета
+	короче, а спуск при извлечении просматривает больше потомков, но они в одной-двух
+	линиях кэша.
+
+	Для уменьшения приоритета хранится позиция каждого ключа в куче.
+*/
+template<typename P, uint16_t D = 4>
+class NHeap
+{
+	static_assert(D >= 2, "Арность кучи должна быть не меньше 2");
+public:
+	// Позиция ключа, которого нет в куче.
+	static constexpr uint64_t INVALID_POSITION = UINT64_MAX;
+private:
+	struct heap_item_t
+	{
+		P priority;
+		uint64_t key;
+	};
+
+	std::vector<heap_item_t> mItems;
+
+	// Позиция каждого ключа в mItems или INVALID_POSITION.
+	std::vector<uint64_t> mPositions;
+public:
+	NHeap(uint64_t keyAmount = 0)
+	{
+		mPositions.assign(keyAmount, INVALID_POSITION);
+	}
+public:
+	bool IsEmpty() const
+	{
+		return mItems.size() == 0;
+	}
+
+	uint64_t GetSize() const
+	{
+		return mItems.size();
+	}
+
+	bool Contains(uint64_t key) const
+	{
+		return mPositions[key] != INVALID_POSITION;
+	}
+
+	// Приоритет ключа, который лежит в куче.
+	P GetPriority(uint64_t key) const
+	{
+		return mItems[mPositions[key]].priority;
+	}
+
+	// Ключ и приоритет вершины кучи. Куча не должна быть пустой.
+
+	uint64_t GetTop() const
+	{
+		return mItems[0].key;
+	}
+
+	P GetTopPriority() const
+	{
+		return mItems[0].priority;
+	}
+public:
+	// Добавление ключа, которого ещё нет в куче.
+	void Push(uint64_t key, P priority)
+	{
+		mItems.push_back({ priority, key });
+		mPositions[key] = mItems.size() - 1;
+
+		SiftUp(mItems.size() - 1);
+	}
+
+	// Уменьшение приоритета ключа из кучи. Возвращает false, если новый приоритет не меньше текущего.
+	bool DecreaseKey(uint64_t key, P priority)
+	{
+		uint64_t position = mPositions[key];
+
+		if (!(priority < mItems[position].priority))
+		{
+			return false;
+		}
+
+		mItems[position].priority = priority;
+		SiftUp(position);
+
+		return true;
+	}
+
+	// Добавление ключа или уменьшение его приоритета, если он уже в куче. Возвращает true, если куча изменилась.
+	bool Update(uint64_t key, P priority)
+	{
+		if (!Contains(key))
+		{
+			Push(key, priority);
+
+			return true;
+		}
+
+		return DecreaseKey(key, priority);
+	}
+
+	// Извлечение ключа с наименьшим приоритетом. Куча не должна быть пустой.
+	uint64_t Pop()
+	{
+		uint64_t top = mItems[0].key;
+		mPositions[top] = INVALID_POSITION;
+
+		heap_item_t last = mItems.back();
+		mItems.pop_back();
+
+		if (mItems.size() > 0)
+		{
+			mItems[0] = last;
+			mPositions[last.key] = 0;
+
+			SiftDown(0);
+		}
+
+		return top;
+	}
+
+	// Очистка кучи. Количество ключей не меняется.
+	void Clear()
+	{
+		for (const heap_item_t& item : mItems)
+		{
+			mPositions[item.key] = INVALID_POSITION;
+		}
+
+		mItems.clear();
+	}
+private:
+	// Подъём элемента: родители с большим приоритетом сдвигаются вниз, сам элемент ставится один раз в конце.
+	void SiftUp(uint64_t position)
+	{
+		heap_item_t item = mItems[position];
+
+		while (position > 0)
+		{
+			uint64_t parent = (position - 1) / D;
+
+			if (!(item.priority < mItems[parent].priority))
+			{
+				break;
+			}
+
+			Place(position, mItems[parent]);
+			position = parent;
+		}
+
+		Place(position, item);
+	}
+
+	// Спуск элемента к наименьшему из D потомков, пока он больше него.
+	void SiftDown(uint64_t position)
+	{
+		heap_item_t item = mItems[position];
+		uint64_t size = mItems.size();
+
+		while (true)
+		{
+			uint64_t first = D * position + 1;
+			if (first >= size)
+			{
+				break;
+			}
+
+			uint64_t last = (first + D < size) ? first + D : size;
+			uint64_t smallest = first;
+
+			for (uint64_t child = first + 1; child < last; child++)
+			{
+				if (mItems[child].priority < mItems[smallest].priority)
+				{
+					smallest = child;
+				}
+			}
+
+			if (!(mItems[smallest].priority < item.priority))
+			{
+				break;
+			}
+
+			Place(position, mItems[smallest]);
+			position = smallest;
+		}
+
+		Place(position, item);
+	}
+
+	void Place(uint64_t position, const heap_item_t& item)
+	{
+		mItems[position] = item;
+		mPositions[item.key] = position;
+	}
+};
@@ -0,0 +1,667 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "ntree.hpp"
+
+/*
+	Журнал изменений дерева для инкрементального сохранения.
+
+	Вместо полного Serialize на каждое сохранение изменения (добавление потомка, удаление
+	поддерева, установка значения) дописываются в конец журнала, поэтому цена сохранения
+	зависит от размера изменения, а не от размера дерева. Лепестки в записях адресуются путём
+	от корня (индексы потомков), так как указатели после восстановления другие.
+
+	На диске лежат файлы с общим префиксом base:
+		base.snapshot.S - полный снимок в формате NLeaf::Serialize, включающий все записи до S;
+		base.journal.F  - сегмент журнала, записи в нём начинаются с номера F.
+	Recover читает последний снимок и проигрывает поверх него все более поздние записи.
+	Compact сворачивает журнал в новый снимок в фоновом потоке и удаляет старые файлы.
+
+	Ошибка записи или синхронизации делает журнал неисправным (IsGood): Commit больше не
+	подтверждает записи, так как неизвестно, какая часть пакета дошла до диска. Всё, что
+	Commit успел подтвердить, восстанавливается; для продолжения журнал нужно открыть заново.
+
+	Запись журнала только фиксирует изменение, само дерево меняет вызывающий. Записывать
+	нужно в том же порядке, в каком изменения применяются к дереву (например, под тем же
+	замком писателя), а ждать записи на диск через Commit можно уже без замка: одновременные
+	Commit из разных потоков объединяются в одну запись и один fsync (групповая фиксация).
+*/
+template<typename T, uint16_t N>
+class NJournal
+{
+public:
+	// Путь к лепестку: индексы потомков от корня. Пустой путь - сам корень.
+	using path_t = std::vector<uint16_t>;
+private:
+	// Вид записи журнала.
+	enum record_kind_t : char
+	{
+		RECORD_ATTACH = 'A',
+		RECORD_REMOVE = 'R',
+		RECORD_SET_VALUE = 'S'
+	};
+
+	// Запись журнала после разбора.
+	struct record_t
+	{
+		uint64_t sequence;
+		record_kind_t kind;
+
+		// Для добавления - путь к родителю, для удаления - путь к удаляемому лепестку.
+		path_t path;
+
+		std::string value;
+	};
+
+	// Префикс файлов журнала и снимков.
+	std::string mBase;
+
+	// Текущий сегмент журнала.
+	FILE* mFile = nullptr;
+
+	std::mutex mMutex;
+	std::condition_variable mCommitted;
+
+	// Записи, ещё не переданные в файл.
+	std::string mPending;
+
+	// Номер последней выданной записи и последней записи, уже сохранённой на диск.
+	uint64_t mLastSequence = 0;
+	uint64_t mDurableSequence = 0;
+
+	// Идёт ли сейчас запись на диск (её делает один поток за всех ожидающих).
+	bool mFlushing = false;
+
+	// Была ли ошибка открытия, записи или синхронизации сегмента.
+	bool mFailed = false;
+
+	// Поток фонового сворачивания журнала в снимок.
+	std::thread mCompaction;
+public:
+	/*
+		Открытие журнала с префиксом base. Нумерация записей продолжается с места, где
+		остановились файлы на диске; новые записи идут в новый сегмент.
+
+		Если журнал новый (на диске нет ни снимков, ни записей) и передано дерево initial, то
+		до первой записи синхронно пишется его снимок, чтобы Recover было от чего отталкиваться.
+		Без снимка Recover проигрывает журнал поверх корня со значением по умолчанию.
+	*/
+	NJournal(const std::string& base, NLeaf<T, N>* initial = nullptr)
+	{
+		mBase = base;
+
+		mLastSequence = FindLastSequence(base);
+		mDurableSequence = mLastSequence;
+
+		if (initial != nullptr && mLastSequence == 0 && ListFiles(base, ".snapshot.").size() <= 0 && !WriteSnapshot(base, initial, 0))
+		{
+			mFailed = true;
+		}
+
+		mFile = OpenSegment(mLastSequence + 1);
+		mFailed |= (mFile == nullptr);
+	}
+
+	~NJournal()
+	{
+		Commit(mLastSequence);
+
+		if (mCompaction.joinable())
+		{
+			mCompaction.join();
+		}
+
+		if (mFile != nullptr)
+		{
+			fclose(mFile);
+		}
+	}
+
+	NJournal(const NJournal&) = delete;
+	NJournal& operator=(const NJournal&) = delete;
+public:
+	// Не было ли ошибок открытия, записи или синхронизации журнала.
+	bool IsGood()
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		return !mFailed;
+	}
+
+	// Запись добавления потомка со значением value последним потомком parent. Возвращает номер записи для Commit.
+	uint64_t AttachNChild(NLeaf<T, N>* parent, T value)
+	{
+		return Append(RECORD_ATTACH, GetPath(parent), &value);
+	}
+
+	// Запись удаления поддерева потомка parent по индексу.
+	uint64_t RemoveNChild(NLeaf<T, N>* parent, uint16_t index)
+	{
+		path_t path = GetPath(parent);
+		path.push_back(index);
+
+		return Append(RECORD_REMOVE, path, nullptr);
+	}
+
+	// Запись установки значения лепестка.
+	uint64_t SetValue(NLeaf<T, N>* leaf, T value)
+	{
+		return Append(RECORD_SET_VALUE, GetPath(leaf), &value);
+	}
+
+	/*
+		Ожидание, пока запись с номером sequence и все предыдущие не окажутся на диске.
+		Первый пришедший поток записывает и синхронизирует всё накопленное за всех,
+		остальные только ждут его. Возвращает false, если записи не удалось сохранить
+		или записи с номером sequence ещё нет (её нельзя дождаться).
+	*/
+	bool Commit(uint64_t sequence)
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+
+		if (sequence > mLastSequence)
+		{
+			return false;
+		}
+
+		while (mDurableSequence < sequence)
+		{
+			if (mFailed)
+			{
+				return false;
+			}
+
+			if (mFlushing)
+			{
+				mCommitted.wait(lock);
+				continue;
+			}
+
+			mFlushing = true;
+
+			std::string batch = {};
+			batch.swap(mPending);
+
+			uint64_t upTo = mLastSequence;
+			FILE* file = mFile;
+
+			lock.unlock();
+			bool written = WriteAndSync(file, batch);
+			lock.lock();
+
+			if (written)
+			{
+				mDurableSequence = upTo;
+			}
+			else
+			{
+				mFailed = true;
+			}
+
+			mFlushing = false;
+
+			mCommitted.notify_all();
+		}
+
+		return true;
+	}
+
+	/*
+		Сворачивание журнала в новый снимок. Дерево tree должно содержать ровно все изменения,
+		записанные в журнал до этого вызова, и не меняться во время вызова: здесь оно только
+		копируется, а запись снимка и удаление старых файлов идут в фоновом потоке.
+		Возвращает false, если журнал неисправен или не удалось дописать текущий сегмент;
+		тогда сворачивание не начинается. Если не удалось записать сам снимок, то старые
+		файлы просто остаются на месте.
+	*/
+	bool Compact(NLeaf<T, N>* tree)
+	{
+		// Предыдущее сворачивание должно закончиться раньше, чем начнётся следующее.
+		if (mCompaction.joinable())
+		{
+			mCompaction.join();
+		}
+
+		uint64_t sequence = 0;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+
+			mCommitted.wait(lock, [&]() -> bool {
+				return !mFlushing;
+			});
+
+			// Дописываем текущий сегмент и переходим на новый, начинающийся после снимка.
+			if (mFailed || !WriteAndSync(mFile, mPending))
+			{
+				mFailed = true;
+				mCommitted.notify_all();
+
+				return false;
+			}
+
+			mPending.clear();
+			mDurableSequence = mLastSequence;
+
+			sequence = mLastSequence;
+
+			fclose(mFile);
+			mFile = OpenSegment(sequence + 1);
+			mFailed = (mFile == nullptr);
+
+			mCommitted.notify_all();
+		}
+
+		NLeaf<T, N>* clone = tree->Clone();
+
+		mCompaction = std::thread([this, clone, sequence]() {
+			if (WriteSnapshot(mBase, clone, sequence))
+			{
+				RemoveFolded(mBase, sequence);
+			}
+
+			delete clone;
+		});
+
+		return true;
+	}
+
+	// Ожидание окончания фонового сворачивания.
+	void WaitCompaction()
+	{
+		if (mCompaction.joinable())
+		{
+			mCompaction.join();
+		}
+	}
+public:
+	/*
+		Восстановление дерева: последний снимок и все более поздние записи журнала поверх него.
+		Оборванная при сбое последняя запись сегмента пропускается. Если снимка нет, то журнал
+		проигрывается поверх корня со значением T(). Если нет ни снимка, ни сегментов или
+		снимок не читается, то возвращается nullptr.
+	*/
+	static NLeaf<T, N>* Recover(const std::string& base, typename NLeaf<T, N>::deserializer_t valueDeserializer)
+	{
+		std::vector<uint64_t> snapshots = ListFiles(base, ".snapshot.");
+		std::vector<uint64_t> segments = ListFiles(base, ".journal.");
+
+		uint64_t snapshotSequence = 0;
+		NLeaf<T, N>* tree = nullptr;
+
+		if (snapshots.size() > 0)
+		{
+			snapshotSequence = snapshots.back();
+
+			std::ifstream stream(base + ".snapshot." + std::to_string(snapshotSequence));
+			NLeaf<T, N>::Deserialize(stream, &tree, valueDeserializer);
+		}
+		else if (segments.size() > 0)
+		{
+			tree = new NLeaf<T, N>(T());
+		}
+
+		if (tree == nullptr)
+		{
+			return nullptr;
+		}
+
+		uint64_t lastSequence = snapshotSequence;
+
+		for (uint64_t segment : segments)
+		{
+			ReadSegment(base, segment, [&](const record_t& record) {
+				// Записи, уже вошедшие в снимок или повторённые, пропускаем.
+				if (record.sequence <= lastSequence)
+				{
+					return;
+				}
+
+				Replay(tree, record, valueDeserializer);
+				lastSequence = record.sequence;
+			});
+		}
+
+		return tree;
+	}
+
+	// Путь от корня до лепестка.
+	static path_t GetPath(NLeaf<T, N>* leaf)
+	{
+		path_t path = {};
+
+		for (; leaf->GetParent() != nullptr; leaf = leaf->GetParent())
+		{
+			path.push_back(leaf->GetChildIndex());
+		}
+
+		std::reverse(path.begin(), path.end());
+
+		return path;
+	}
+private:
+	// Добавление записи в буфер. Формат строки: "номер вид длина_пути индексы... :значение".
+	uint64_t Append(record_kind_t kind, const path_t& path, const T* value)
+	{
+		std::ostringstream line = {};
+		line << (char)kind << " " << path.size();
+
+		for (uint16_t index : path)
+		{
+			line << " " << index;
+		}
+
+		line << " :";
+		if (value != nullptr)
+		{
+			line << *value;
+		}
+
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		uint64_t sequence = ++mLastSequence;
+
+		mPending += std::to_string(sequence);
+		mPending += " ";
+		mPending += line.str();
+		mPending += "\n";
+
+		return sequence;
+	}
+
+	// Применение записи к дереву при восстановлении. Записи с несуществующим путём пропускаются.
+	static void Replay(NLeaf<T, N>* tree, const record_t& record, typename NLeaf<T, N>::deserializer_t& valueDeserializer)
+	{
+		size_t pathLength = record.path.size();
+		if (record.kind == RECORD_REMOVE)
+		{
+			if (pathLength <= 0)
+			{
+				return;
+			}
+
+			pathLength--;
+		}
+
+		NLeaf<T, N>* leaf = tree;
+		for (size_t p = 0; p < pathLength; p++)
+		{
+			if (record.path[p] >= leaf->GetChildAmount())
+			{
+				return;
+			}
+
+			leaf = *leaf->GetNChild(record.path[p]);
+		}
+
+		switch (record.kind)
+		{
+		case RECORD_ATTACH:
+			if (leaf->GetChildAmount() < N)
+			{
+				leaf->GraftNChild(new NLeaf<T, N>(valueDeserializer(record.value)));
+			}
+			break;
+		case RECORD_REMOVE:
+			if (record.path.back() < leaf->GetChildAmount())
+			{
+				leaf->RemoveNChild(record.path.back());
+			}
+			break;
+		case RECORD_SET_VALUE:
+			leaf->SetValue(valueDeserializer(record.value));
+			break;
+		}
+	}
+
+	// Чтение всех целых записей сегмента по порядку.
+	template<typename C>
+	static void ReadSegment(const std::string& base, uint64_t segment, C callback)
+	{
+		std::ifstream stream(base + ".journal." + std::to_string(segment));
+
+		std::string curline = "";
+		while (std::getline(stream, curline))
+		{
+			// Строка без перевода строки в конце файла оборвана при сбое.
+			if (stream.eof())
+			{
+				break;
+			}
+
+			size_t delimiterPos = curline.find(':');
+			if (delimiterPos == std::string::npos)
+			{
+				break;
+			}
+
+			std::istringstream header(curline.substr(0, delimiterPos));
+
+			record_t record = {};
+			char kind = 0;
+			size_t pathLength = 0;
+
+			header >> record.sequence >> kind >> pathLength;
+			record.kind = (record_kind_t)kind;
+			record.path.resize(pathLength);
+
+			for (size_t p = 0; p < pathLength; p++)
+			{
+				header >> record.path[p];
+			}
+
+			if (header.fail())
+			{
+				break;
+			}
+
+			record.value = curline.substr(delimiterPos + 1);
+
+			callback(record);
+		}
+	}
+
+	// Номера файлов base + infix + номер, по возрастанию. Незаконченные снимки (.tmp) не учитываются.
+	static std::vector<uint64_t> ListFiles(const std::string& base, const std::string& infix)
+	{
+		std::filesystem::path basePath(base);
+		std::filesystem::path directory = basePath.has_parent_path() ? basePath.parent_path() : std::filesystem::path(".");
+		std::string prefix = basePath.filename().string() + infix;
+
+		std::vector<uint64_t> result = {};
+
+		std::error_code error = {};
+		for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(directory, error))
+		{
+			std::string name = entry.path().filename().string();
+			if (name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix) != 0)
+			{
+				continue;
+			}
+
+			std::string number = name.substr(prefix.size());
+			if (number.find_first_not_of("0123456789") != std::string::npos)
+			{
+				continue;
+			}
+
+			result.push_back(std::stoull(number));
+		}
+
+		std::sort(result.begin(), result.end());
+
+		return result;
+	}
+
+	// Номер последней записи, которая уже есть на диске: в снимке или в последнем сегменте.
+	static uint64_t FindLastSequence(const std::string& base)
+	{
+		uint64_t lastSequence = 0;
+
+		std::vector<uint64_t> snapshots = ListFiles(base, ".snapshot.");
+		if (snapshots.size() > 0)
+		{
+			lastSequence = snapshots.back();
+		}
+
+		std::vector<uint64_t> segments = ListFiles(base, ".journal.");
+		if (segments.size() > 0)
+		{
+			lastSequence = std::max(lastSequence, segments.back() - 1);
+
+			ReadSegment(base, segments.back(), [&](const record_t& record) {
+				lastSequence = std::max(lastSequence, record.sequence);
+			});
+		}
+
+		return lastSequence;
+	}
+
+	// Удаление снимков и сегментов, целиком вошедших в снимок с номером sequence.
+	static void RemoveFolded(const std::string& base, uint64_t sequence)
+	{
+		std::error_code error = {};
+
+		for (uint64_t snapshot : ListFiles(base, ".snapshot."))
+		{
+			if (snapshot < sequence)
+			{
+				std::filesystem::remove(base + ".snapshot." + std::to_string(snapshot), error);
+			}
+		}
+
+		// Сегмент, начинающийся не позже sequence, заканчивается не позже sequence: следующий начат с sequence + 1.
+		for (uint64_t segment : ListFiles(base, ".journal."))
+		{
+			if (segment <= sequence)
+			{
+				std::filesystem::remove(base + ".journal." + std::to_string(segment), error);
+			}
+		}
+	}
+
+	/*
+		Запись снимка дерева с номером sequence. Снимок становится видимым для Recover только
+		целиком: он пишется во временный файл, синхронизируется и переименовывается, после чего
+		синхронизируется каталог, чтобы переименование пережило сбой. При ошибке временный файл удаляется.
+	*/
+	static bool WriteSnapshot(const std::string& base, NLeaf<T, N>* tree, uint64_t sequence)
+	{
+		std::string path = base + ".snapshot." + std::to_string(sequence);
+		std::string temporaryPath = path + ".tmp";
+
+		bool written = false;
+		{
+			std::ofstream stream(temporaryPath, std::ios::trunc);
+			tree->Serialize(stream);
+			stream.flush();
+
+			written = stream.good();
+		}
+
+		std::error_code error = {};
+
+		if (!written || !SyncPath(temporaryPath))
+		{
+			std::filesystem::remove(temporaryPath, error);
+
+			return false;
+		}
+
+		std::filesystem::rename(temporaryPath, path, error);
+		if (error)
+		{
+			std::filesystem::remove(temporaryPath, error);
+
+			return false;
+		}
+
+		return SyncDirectory(path);
+	}
+
+	FILE* OpenSegment(uint64_t firstSequence)
+	{
+		return fopen((mBase + ".journal." + std::to_string(firstSequence)).c_str(), "ab");
+	}
+
+	// Запись и синхронизация пакета. Возвращает false, если хоть один шаг не удался.
+	static bool WriteAndSync(FILE* file, const std::string& data)
+	{
+		if (file == nullptr)
+		{
+			return false;
+		}
+
+		if (data.size() <= 0)
+		{
+			return true;
+		}
+
+		if (fwrite(data.data(), 1, data.size(), file) != data.size() || fflush(file) != 0)
+		{
+			return false;
+		}
+
+#if defined(_WIN32)
+		return _commit(_fileno(file)) == 0;
+#else
+		return fsync(fileno(file)) == 0;
+#endif
+	}
+
+	static bool SyncPath(const std::string& path)
+	{
+		FILE* file = fopen(path.c_str(), "ab");
+		if (file == nullptr)
+		{
+			return false;
+		}
+
+#if defined(_WIN32)
+		bool synced = _commit(_fileno(file)) == 0;
+#else
+		bool synced = fsync(fileno(file)) == 0;
+#endif
+
+		return (fclose(file) == 0) && synced;
+	}
+
+	// Синхронизация каталога файла path, чтобы его создание или переименование дошло до диска.
+	static bool SyncDirectory(const std::string& path)
+	{
+#if defined(_WIN32)
+		// В Windows каталог так не синхронизировать, изменения метаданных NTFS журналирует сама.
+		return true;
+#else
+		std::filesystem::path filePath(path);
+		std::string directory = filePath.has_parent_path() ? filePath.parent_path().string() : std::string(".");
+
+		int descriptor = open(directory.c_str(), O_RDONLY);
+		if (descriptor < 0)
+		{
+			return false;
+		}
+
+		bool synced = fsync(descriptor) == 0;
+
+		return (close(descriptor) == 0) && synced;
+#endif
+	}
+};
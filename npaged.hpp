@@ -0,0 +1,562 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "ntree.hpp"
+
+/*
+	Лепесток дерева во внешней памяти в том виде, в котором он лежит на странице файла.
+	Вместо указателей - номера лепестков, поэтому запись можно вытеснить на диск и прочитать обратно.
+*/
+template<typename T, uint16_t N>
+struct paged_leaf_t
+{
+	// Значение лепестка.
+	T value;
+
+	// Глубина, индекс в массиве потомков и количество детей, как в NLeaf.
+	uint16_t depth;
+	uint16_t childIndex;
+	uint16_t childrenAmount;
+
+	// Номер родителя и номера потомков.
+	uint64_t parent;
+	uint64_t children[N];
+};
+
+/*
+	N дерево во внешней памяти: лепестки лежат в файле страницами фиксированного размера,
+	а в памяти держится только ограниченный пул страниц (buffer pool) с вытеснением по
+	алгоритму CLOCK. Walk, GetNChild и SetNChild работают одинаково, лежит ли нужная страница
+	в пуле или уже вытеснена на диск.
+
+	Лепестки адресуются номерами, выдаваемыми Allocate. Ссылки на данные лепестка наружу не
+	отдаются, так как страница может быть вытеснена при следующем же обращении.
+*/
+template<typename T, uint16_t N>
+class PagedNTree
+{
+	static_assert(std::is_trivially_copyable_v<T>, "PagedNTree хранит значения на диске побайтово, T должен быть тривиально копируемым");
+public:
+	// Размер страницы в байтах.
+	static constexpr size_t PAGE_SIZE = 4096;
+
+	// Количество лепестков на странице.
+	static constexpr size_t LEAVES_PER_PAGE = PAGE_SIZE / sizeof(paged_leaf_t<T, N>);
+
+	static_assert(LEAVES_PER_PAGE > 0, "Лепесток не помещается на страницу");
+
+	// Номер несуществующего лепестка.
+	static constexpr uint64_t INVALID_LEAF = UINT64_MAX;
+
+	// Callback итерации. Смысл возвращаемого значения такой же, как в NLeaf::Walk.
+	using walk_callback_t = std::function<bool(uint64_t)>;
+
+	// Десериализатор значений, как в NLeaf.
+	using deserializer_t = std::function<T(const std::string&)>;
+private:
+	// Заголовок файла. Лежит в начале файла и занимает одну страницу.
+	struct paged_header_t
+	{
+		uint64_t magic;
+		uint64_t leafSize;
+		uint64_t leafAmount;
+		uint64_t root;
+	};
+
+	static constexpr uint64_t PAGED_MAGIC = 0x3165657274746e50; // "Pnttree1"
+	static constexpr uint64_t INVALID_PAGE = UINT64_MAX;
+
+	// Кадр, который не удалось освободить.
+	static constexpr size_t INVALID_FRAME = SIZE_MAX;
+
+	// Кадр пула - место под одну страницу в памяти.
+	struct frame_t
+	{
+		uint64_t page;
+		bool dirty;
+
+		// Бит обращения для CLOCK: страница недавно использовалась и заслуживает второго шанса.
+		bool referenced;
+	};
+
+	std::fstream mFile;
+	paged_header_t mHeader;
+
+	// Память всех кадров одним куском и их описания.
+	std::vector<uint8_t> mPoolMemory;
+	std::vector<frame_t> mFrames;
+
+	// Какая страница в каком кадре.
+	std::unordered_map<uint64_t, size_t> mPageTable;
+
+	// Стрелка CLOCK.
+	size_t mClockHand = 0;
+
+	// Была ли ошибка чтения или записи файла. После неё содержимое файла не гарантируется.
+	bool mFailed = false;
+
+	// Запись, которую Fetch отдаёт, если в пуле не нашлось кадра. Изменения в ней теряются, а дерево помнит сбой.
+	paged_leaf_t<T, N> mScratch = {};
+
+	// Статистика пула.
+	uint64_t mHits = 0;
+	uint64_t mMisses = 0;
+public:
+	/*
+		Открытие дерева в файле path. Если create установлен, то файл создаётся заново.
+		poolPages - сколько страниц одновременно держать в памяти.
+
+		Существующий файл с нечитаемым заголовком, чужой сигнатурой или другим размером лепестка
+		не открывается: IsOpen() вернёт false, и в такой файл ничего не записывается.
+	*/
+	PagedNTree(const std::string& path, size_t poolPages, bool create)
+	{
+		std::ios::openmode mode = std::ios::in | std::ios::out | std::ios::binary;
+		if (create)
+		{
+			mode |= std::ios::trunc;
+		}
+
+		mFile.open(path, mode);
+
+		mHeader = { PAGED_MAGIC, sizeof(paged_leaf_t<T, N>), 0, INVALID_LEAF };
+
+		if (!create && mFile.is_open())
+		{
+			paged_header_t header = {};
+			mFile.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+			if (mFile && header.magic == PAGED_MAGIC && header.leafSize == sizeof(paged_leaf_t<T, N>))
+			{
+				mHeader = header;
+			}
+			else
+			{
+				mFile.close();
+			}
+		}
+
+		poolPages = (poolPages > 0) ? poolPages : 1;
+
+		mPoolMemory.resize(poolPages * PAGE_SIZE);
+		mFrames.resize(poolPages, { INVALID_PAGE, false, false });
+	}
+
+	// Закрытие дерева с записью всех изменённых страниц.
+	~PagedNTree()
+	{
+		Flush();
+	}
+
+	PagedNTree(const PagedNTree&) = delete;
+	PagedNTree& operator=(const PagedNTree&) = delete;
+public:
+	// Открылся ли файл.
+	bool IsOpen()
+	{
+		return mFile.is_open();
+	}
+
+	// Не было ли ошибок чтения или записи с момента открытия.
+	bool IsGood()
+	{
+		return mFile.is_open() && !mFailed;
+	}
+
+	/*
+		Запись всех изменённых страниц и заголовка в файл. Возвращает false, если файл не открыт
+		или какая-то запись, в том числе более ранняя при вытеснении, не удалась.
+	*/
+	bool Flush()
+	{
+		if (!mFile.is_open())
+		{
+			return false;
+		}
+
+		for (size_t f = 0; f < mFrames.size(); f++)
+		{
+			if (mFrames[f].dirty)
+			{
+				WritePage(f);
+			}
+		}
+
+		// Заголовок пишется последним и только если все страницы дошли до файла.
+		if (!mFailed)
+		{
+			mFile.clear();
+			mFile.seekp(0);
+			mFile.write(reinterpret_cast<const char*>(&mHeader), sizeof(mHeader));
+			mFile.flush();
+
+			mFailed = !mFile;
+		}
+
+		return !mFailed;
+	}
+public:
+	// Создание нового лепестка со значением value. Возвращает его номер.
+	uint64_t Allocate(T value)
+	{
+		uint64_t leaf = mHeader.leafAmount++;
+
+		paged_leaf_t<T, N>& record = Fetch(leaf, true);
+		record.value = value;
+		record.depth = 0;
+		record.childIndex = 0;
+		record.childrenAmount = 0;
+		record.parent = INVALID_LEAF;
+
+		for (uint16_t c = 0; c < N; c++)
+		{
+			record.children[c] = INVALID_LEAF;
+		}
+
+		return leaf;
+	}
+
+	// Установка потомка, как в NLeaf::SetNChild.
+	void SetNChild(uint64_t parent, uint16_t index, uint64_t leaf)
+	{
+		uint16_t depth = Fetch(parent, false).depth;
+
+		// Каждое обращение заново берёт страницу из пула: предыдущая могла быть вытеснена.
+		paged_leaf_t<T, N>& child = Fetch(leaf, true);
+		child.childIndex = index;
+		child.depth = depth + 1;
+		child.parent = parent;
+
+		paged_leaf_t<T, N>& record = Fetch(parent, true);
+		record.children[index] = leaf;
+		record.childrenAmount++;
+	}
+
+	uint64_t GetNChild(uint64_t leaf, uint16_t index)
+	{
+		return Fetch(leaf, false).children[index];
+	}
+
+	T GetValue(uint64_t leaf)
+	{
+		return Fetch(leaf, false).value;
+	}
+
+	void SetValue(uint64_t leaf, T value)
+	{
+		Fetch(leaf, true).value = value;
+	}
+
+	uint16_t GetDepth(uint64_t leaf)
+	{
+		return Fetch(leaf, false).depth;
+	}
+
+	uint16_t GetChildAmount(uint64_t leaf)
+	{
+		return Fetch(leaf, false).childrenAmount;
+	}
+
+	uint16_t GetChildIndex(uint64_t leaf)
+	{
+		return Fetch(leaf, false).childIndex;
+	}
+
+	uint64_t GetParent(uint64_t leaf)
+	{
+		return Fetch(leaf, false).parent;
+	}
+
+	// Корень дерева хранится в заголовке файла.
+
+	uint64_t GetRoot()
+	{
+		return mHeader.root;
+	}
+
+	void SetRoot(uint64_t leaf)
+	{
+		mHeader.root = leaf;
+	}
+
+	uint64_t GetLeafAmount()
+	{
+		return mHeader.leafAmount;
+	}
+
+	// Статистика пула: попадания и промахи.
+
+	uint64_t GetHitAmount()
+	{
+		return mHits;
+	}
+
+	uint64_t GetMissAmount()
+	{
+		return mMisses;
+	}
+public:
+	// Итерация в ширину, начиная с лепестка from (по умолчанию с корня). Работает так же, как NLeaf::Walk.
+	void Walk(walk_callback_t walker, uint64_t from = INVALID_LEAF)
+	{
+		std::queue<uint64_t> collected = {};
+		collected.push((from == INVALID_LEAF) ? mHeader.root : from);
+
+		while (collected.size() > 0 && collected.front() != INVALID_LEAF)
+		{
+			uint64_t leaf = collected.front();
+			collected.pop();
+
+			const paged_leaf_t<T, N>& record = Fetch(leaf, false);
+			for (uint16_t c = 0; c < record.childrenAmount; c++)
+			{
+				collected.push(record.children[c]);
+			}
+
+			if (walker(leaf))
+			{
+				break;
+			}
+		}
+	}
+
+	// Сериализация в формате NLeaf::Serialize.
+	void Serialize(std::ostream& stream)
+	{
+		Walk([&](uint64_t leaf) -> bool {
+			const paged_leaf_t<T, N>& record = Fetch(leaf, false);
+
+			stream << record.childrenAmount << ":" << record.value << std::endl;
+
+			return false;
+		});
+	}
+
+	/*
+		Десериализация файла формата NLeaf::Serialize прямо во внешнюю память, минуя NLeaf.
+		В памяти держится только очередь ещё не прочитанных лепестков. Прочитанное дерево
+		становится корнем.
+	*/
+	void Deserialize(std::istream& stream, deserializer_t valueDeserializer)
+	{
+		// Очередь пар "родитель - индекс" лепестков, которые ещё предстоит прочитать.
+		std::queue<std::pair<uint64_t, uint16_t>> toPopulate = {};
+		toPopulate.push({ INVALID_LEAF, 0 });
+
+		std::string curline = "";
+
+		while (stream.good() && toPopulate.size() > 0)
+		{
+			std::getline(stream, curline);
+
+			size_t delimiterPos = curline.find(':');
+			if (curline.size() <= 0 || delimiterPos == std::string::npos)
+			{
+				continue;
+			}
+
+			uint16_t childrenAmount = (uint16_t)std::stoul(curline.substr(0, delimiterPos));
+			uint64_t leaf = Allocate(valueDeserializer(curline.substr(delimiterPos + 1)));
+
+			std::pair<uint64_t, uint16_t> leafData = toPopulate.front();
+			toPopulate.pop();
+
+			if (leafData.first == INVALID_LEAF)
+			{
+				SetRoot(leaf);
+			}
+			else
+			{
+				SetNChild(leafData.first, leafData.second, leaf);
+			}
+
+			for (uint16_t c = 0; c < childrenAmount; c++)
+			{
+				toPopulate.push({ leaf, c });
+			}
+		}
+	}
+
+	// Перенос обычного дерева во внешнюю память в порядке обхода в ширину. Возвращает номер корня копии.
+	uint64_t Append(NLeaf<T, N>* tree)
+	{
+		std::queue<std::pair<uint64_t, uint16_t>> parents = {};
+		parents.push({ INVALID_LEAF, 0 });
+
+		uint64_t root = INVALID_LEAF;
+
+		tree->Walk([&](NLeaf<T, N>* source) -> bool {
+			uint64_t leaf = Allocate(source->GetValue());
+
+			std::pair<uint64_t, uint16_t> leafData = parents.front();
+			parents.pop();
+
+			if (leafData.first == INVALID_LEAF)
+			{
+				root = leaf;
+			}
+			else
+			{
+				SetNChild(leafData.first, leafData.second, leaf);
+			}
+
+			// Walk пропускает пустые слоты, поэтому индексы считаем только по настоящим потомкам.
+			uint16_t childIndex = 0;
+			for (uint16_t c = 0; c < source->GetChildAmount(); c++)
+			{
+				if (*source->GetNChild(c) != nullptr)
+				{
+					parents.push({ leaf, childIndex++ });
+				}
+			}
+
+			return false;
+		});
+
+		return root;
+	}
+private:
+	/*
+		Получение записи лепестка через пул. Если страницы нет в пуле, то она читается с диска,
+		вытесняя жертву по CLOCK. Ссылка действительна только до следующего Fetch.
+	*/
+	paged_leaf_t<T, N>& Fetch(uint64_t leaf, bool willModify)
+	{
+		uint64_t page = leaf / LEAVES_PER_PAGE;
+		size_t frame = 0;
+
+		auto found = mPageTable.find(page);
+		if (found != mPageTable.end())
+		{
+			frame = found->second;
+			mHits++;
+		}
+		else
+		{
+			frame = Evict();
+			mMisses++;
+
+			if (frame == INVALID_FRAME)
+			{
+				mFailed = true;
+				mScratch = {};
+
+				return mScratch;
+			}
+
+			ReadPage(frame, page);
+		}
+
+		mFrames[frame].referenced = true;
+		mFrames[frame].dirty |= willModify;
+
+		uint8_t* data = mPoolMemory.data() + frame * PAGE_SIZE;
+
+		return reinterpret_cast<paged_leaf_t<T, N>*>(data)[leaf % LEAVES_PER_PAGE];
+	}
+
+	/*
+		Выбор кадра под новую страницу по CLOCK с записью вытесняемой страницы, если она изменена.
+		Изменённая страница, которую не удалось записать, остаётся в пуле, и выбирается следующий кадр.
+		За два оборота стрелки каждый кадр проверяется хотя бы раз со сброшенным битом обращения,
+		поэтому если и тогда кадра нет, то возвращается INVALID_FRAME.
+	*/
+	size_t Evict()
+	{
+		for (size_t step = 0; step < 2 * mFrames.size(); step++)
+		{
+			size_t frame = mClockHand;
+			mClockHand = (mClockHand + 1) % mFrames.size();
+
+			if (mFrames[frame].page == INVALID_PAGE)
+			{
+				return frame;
+			}
+
+			if (mFrames[frame].referenced)
+			{
+				mFrames[frame].referenced = false;
+
+				continue;
+			}
+
+			if (mFrames[frame].dirty && !WritePage(frame))
+			{
+				continue;
+			}
+
+			mPageTable.erase(mFrames[frame].page);
+			mFrames[frame].page = INVALID_PAGE;
+
+			return frame;
+		}
+
+		return INVALID_FRAME;
+	}
+
+	/*
+		Чтение страницы в кадр. Страницы за концом файла ещё не записывались и считаются пустыми,
+		поэтому короткое чтение у конца файла - не ошибка, а ошибка потока (badbit) - ошибка.
+	*/
+	void ReadPage(size_t frame, uint64_t page)
+	{
+		char* data = reinterpret_cast<char*>(mPoolMemory.data() + frame * PAGE_SIZE);
+
+		memset(data, 0, PAGE_SIZE);
+
+		if (mFile.is_open())
+		{
+			mFile.clear();
+			mFile.seekg((std::streamoff)((page + 1) * PAGE_SIZE));
+			mFile.read(data, PAGE_SIZE);
+
+			mFailed |= mFile.bad();
+			mFile.clear();
+		}
+
+		mFrames[frame] = { page, false, false };
+		mPageTable[page] = frame;
+	}
+
+	/*
+		Запись страницы из кадра на её место в файле. Нулевая страница файла - заголовок.
+		При ошибке страница остаётся изменённой, а дерево запоминает сбой (IsGood, Flush).
+		Возвращает, записана ли страница.
+	*/
+	bool WritePage(size_t frame)
+	{
+		if (!mFile.is_open())
+		{
+			mFailed = true;
+
+			return false;
+		}
+
+		const char* data = reinterpret_cast<const char*>(mPoolMemory.data() + frame * PAGE_SIZE);
+
+		mFile.clear();
+		mFile.seekp((std::streamoff)((mFrames[frame].page + 1) * PAGE_SIZE));
+		mFile.write(data, PAGE_SIZE);
+
+		if (!mFile)
+		{
+			mFailed = true;
+			mFile.clear();
+
+			return false;
+		}
+
+		mFrames[frame].dirty = false;
+
+		return true;
+	}
+};
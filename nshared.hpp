@@ -0,0 +1,129 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "nflat.hpp"
+#include "nutility.hpp"
+
+/*
+	Плоское дерево в именованной разделяемой памяти.
+
+	Один процесс строит дерево один раз и публикует его через Publish, остальные процессы
+	подключаются через Attach и читают то же самое дерево без копирования и без Deserialize.
+	NFlatTree хранит смещения, а не указатели, поэтому сегмент можно отображать по любому адресу.
+
+	В POSIX сегмент живёт до вызова Unlink, даже если публикующий процесс завершился.
+	В Windows сегмент живёт, пока открыт хотя бы один NSharedTree, поэтому публикующий
+	процесс должен держать свой объект, пока работают читатели.
+
+	Сигнатура в начале буфера NFlatTree записывается последней, с release-семантикой, а Attach
+	читает её с acquire-семантикой. Поэтому читатель, подключившийся во время публикации, видит
+	либо неготовый сегмент (Attach возвращает false, можно повторить), либо дерево целиком.
+*/
+template<typename T>
+class NSharedTree
+{
+private:
+	// Отображённый сегмент.
+	NMapping mMapping;
+
+	// Представление дерева поверх сегмента.
+	NFlatTree<T> mTree;
+public:
+	NSharedTree() = default;
+
+	~NSharedTree()
+	{
+		Close();
+	}
+
+	NSharedTree(const NSharedTree&) = delete;
+	NSharedTree& operator=(const NSharedTree&) = delete;
+public:
+	/*
+		Публикация дерева в сегмент с именем name (в POSIX имя начинается с '/'). Возвращает false при ошибке.
+
+		Существующий сегмент не перезаписывается на месте: в POSIX старое имя удаляется и создаётся
+		новый сегмент, а уже подключённые читатели продолжают читать старый, пока не закроются.
+		В Windows имя нельзя освободить, пока его держат читатели, поэтому публикация под занятым
+		именем не удаётся.
+	*/
+	bool Publish(const NFlatTree<T>& tree, const std::string& name)
+	{
+		Close();
+
+		size_t byteSize = (size_t)tree.GetByteSize();
+
+		if (byteSize < sizeof(uint64_t) || !mMapping.CreateShared(name, byteSize))
+		{
+			return false;
+		}
+
+		// Всё, кроме сигнатуры, затем сигнатура: по ней читатели узнают, что дерево записано.
+		const uint8_t* data = static_cast<const uint8_t*>(tree.GetData());
+		uint8_t* mapping = static_cast<uint8_t*>(mMapping.GetData());
+		memcpy(mapping + sizeof(uint64_t), data + sizeof(uint64_t), byteSize - sizeof(uint64_t));
+
+		uint64_t magic = 0;
+		memcpy(&magic, data, sizeof(magic));
+		std::atomic_ref<uint64_t>(*reinterpret_cast<uint64_t*>(mapping)).store(magic, std::memory_order_release);
+
+		mTree = NFlatTree<T>::View(mapping, mMapping.GetSize());
+
+		return true;
+	}
+
+	/*
+		Подключение к опубликованному сегменту только для чтения. Возвращает false, если его нет,
+		публикация ещё не закончена или заголовок не сходится с размером сегмента.
+	*/
+	bool Attach(const std::string& name)
+	{
+		Close();
+
+		if (!mMapping.OpenShared(name))
+		{
+			return false;
+		}
+
+		// Сегмент отображён только для чтения, но атомарное чтение ничего в него не пишет.
+		uint64_t* magicAddress = static_cast<uint64_t*>(mMapping.GetData());
+		uint64_t magic = (mMapping.GetSize() >= sizeof(uint64_t)) ? std::atomic_ref<uint64_t>(*magicAddress).load(std::memory_order_acquire) : 0;
+
+		if (magic != 0)
+		{
+			mTree = NFlatTree<T>::View(mMapping.GetData(), mMapping.GetSize());
+		}
+
+		if (mTree.GetLeafAmount() <= 0)
+		{
+			Close();
+
+			return false;
+		}
+
+		return true;
+	}
+
+	// Дерево в сегменте. Действительно, пока открыт этот объект.
+	const NFlatTree<T>& GetTree() const
+	{
+		return mTree;
+	}
+
+	// Отключение от сегмента. Сам сегмент при этом не удаляется (см. Unlink).
+	void Close()
+	{
+		mTree = NFlatTree<T>();
+		mMapping.Close();
+	}
+
+	// Удаление имени сегмента. Уже подключённые процессы продолжают читать, пока не закроются.
+	static void Unlink(const std::string& name)
+	{
+		NMapping::UnlinkShared(name);
+	}
+};
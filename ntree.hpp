@@ -1,9 +1,25 @@
 ﻿#pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <deque>
 #include <queue>
 #include <functional>
 #include <string>
+#include <thread>
+#include <vector>
+
+// Программная предвыборка строки кэша по адресу. На платформах без неё ничего не делает.
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <xmmintrin.h>
+#define NTREE_PREFETCH(address) _mm_prefetch(reinterpret_cast<const char*>(address), _MM_HINT_T0)
+#elif defined(__GNUC__) || defined(__clang__)
+#define NTREE_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define NTREE_PREFETCH(address) ((void)(address))
+#endif
 
 // Объявление лепестка наперёд.
 template<typename T, uint16_t N>
@@ -13,6 +29,14 @@ class NLeaf;
 template<typename T, uint16_t N>
 using NTree = NLeaf<T, N>;
 
+// Объявление хранилища лепестков наперёд (см. narena.hpp).
+template<typename T, uint16_t N>
+class NArena;
+
+// Объявление массового построителя деревьев наперёд (см. nbuild.hpp).
+template<typename T, uint16_t N>
+class NBuilder;
+
 // Данные, используемые для генерации и десериализации лепестка.
 template<typename T, uint16_t N>
 struct leaf_generation_data_t
@@ -31,6 +55,8 @@ struct leaf_generation_data_t
 template<typename T, uint16_t N>
 class NLeaf
 {
+	friend class NArena<T, N>;
+	friend class NBuilder<T, N>;
 public:
 	/*
 		Этот callback используется в итерации по дереву. Его задаёт программист, чтобы
@@ -63,8 +89,36 @@ private:
 	// Количество детей данного лепестка.
 	uint16_t mChildrenAmount;
 
+	// Флаги лепестка (LEAF_FLAG_*).
+	uint16_t mFlags;
+
+	// Родитель лепестка. У корня равен nullptr.
+	NLeaf<T, N>* mParent;
+
+	// Закэшированный хэш поддерева (см. GetHash). Действителен, если не стоит LEAF_FLAG_STALE_HASH.
+	uint64_t mHash;
+
 	// Потомки лепестка.
 	NLeaf<T, N>* mChildren[N];
+
+	// Лепесток лежит в NArena и удаляется вместе с ней, а не через delete.
+	static constexpr uint16_t LEAF_FLAG_ARENA = 1 << 0;
+
+	// Глубина потомков этого лепестка устарела после GraftNChild и будет обновлена при следующем Walk.
+	static constexpr uint16_t LEAF_FLAG_STALE_DEPTH = 1 << 1;
+
+	// Лепесток лежит в списке свободных лепестков NArena. mChildren[0] указывает на следующий свободный.
+	static constexpr uint16_t LEAF_FLAG_FREE = 1 << 2;
+
+	/*
+		Хэш поддерева этого лепестка устарел. Если флаг стоит на лепестке, то он стоит и на всех
+		его предках, поэтому инвалидация после изменения поднимается только до первого уже
+		помеченного предка.
+	*/
+	static constexpr uint16_t LEAF_FLAG_STALE_HASH = 1 << 3;
+
+	// Дистанция предвыборки в Walk по умолчанию (см. SetPrefetchDistance).
+	inline static uint16_t sPrefetchDistance = 8;
 public:
 	// Стандартный конструктор лепестка.
 	NLeaf()
@@ -75,6 +129,9 @@ public:
 		mChildIndex = 0;
 
 		mChildrenAmount = 0;
+		mFlags = LEAF_FLAG_STALE_HASH;
+		mParent = nullptr;
+		mHash = 0;
 		memset(mChildren, 0, sizeof(mChildren));
 	}
 
@@ -87,14 +144,28 @@ public:
 		mChildIndex = 0;
 
 		mChildrenAmount = 0;
+		mFlags = LEAF_FLAG_STALE_HASH;
+		mParent = nullptr;
+		mHash = 0;
 		memset(mChildren, 0, sizeof(mChildren));
 	}
 
 	// Деструктор лепестка, уничтожающий всех потомков в цикле. Метод Walk описывается чуть ниже.
 	~NLeaf()
 	{
-		// Проходимся по всем потомкам и удаляем их, не включая себя.
+		// Лепестки из NArena освобождает сама NArena.
+		if (mFlags & LEAF_FLAG_ARENA)
+		{
+			return;
+		}
+
+		/*
+			Проходимся по всем потомкам и удаляем их, не включая себя.
+			Потомки удаляемого лепестка к этому моменту уже в очереди Walk, поэтому
+			обнуляем их количество, чтобы деструктор лепестка не удалил их второй раз.
+		*/
 		Walk([](NLeaf<T, N>* leaf) -> bool {
+			leaf->mChildrenAmount = 0;
 			delete leaf;
 
 			return false;
@@ -125,11 +196,14 @@ public:
 		Если флаг includeSelf установлен в false, то лямбда walker не будет вызвана
 		на корень, то есть на лепесток, который вызвал метод Walk. Это нужно, чтобы пройтись
 		только по потомкам лепестка, не включая сам лепесток.
+
+		prefetchDistance - на сколько лепестков вперёд по очереди заранее подгружать в кэш
+		сам лепесток и его массив потомков. 0 выключает предвыборку.
 	*/
-	void Walk(walk_callback_t walker, bool includeSelf = true)
+	void Walk(walk_callback_t walker, bool includeSelf = true, uint16_t prefetchDistance = sPrefetchDistance)
 	{
-		// Очередь лепестков для итерации.
-		std::queue<NLeaf<T, N>*> collected = {};
+		// Очередь лепестков для итерации. deque, а не queue, чтобы заглядывать вперёд для предвыборки.
+		std::deque<NLeaf<T, N>*> collected = {};
 
 		/*
 			Если надо добавить текущий лепесток, то добавляем this в очередь.
@@ -137,13 +211,23 @@ public:
 		*/
 		if (includeSelf)
 		{
-			collected.push(this);
+			collected.push_back(this);
 		}
 		else
 		{
-			for (uint16_t c = 0; c < mChildrenAmount; c++)
+			PropagateDepth();
+
+			uint16_t childrenAmount = LoadChildrenAmount();
+
+			for (uint16_t c = 0; c < childrenAmount; c++)
 			{
-				collected.push(mChildren[c]);
+				NLeaf<T, N>* child = LoadNChild(c);
+
+				// Слот может быть уже занят параллельным писателем, но ещё не опубликован.
+				if (child != nullptr)
+				{
+					collected.push_back(child);
+				}
 			}
 		}
 
@@ -152,13 +236,35 @@ public:
 		{
 			// Получаем первый на очереди лепесток.
 			NLeaf<T, N>* leaf = collected.front();
-			collected.pop();
+			collected.pop_front();
+
+			/*
+				Подгружаем лепесток, до которого очередь дойдёт через prefetchDistance шагов.
+				К тому моменту его значение и указатели на потомков уже будут в кэше.
+			*/
+			if (prefetchDistance > 0 && collected.size() >= prefetchDistance)
+			{
+				NLeaf<T, N>* ahead = collected[prefetchDistance - 1];
+
+				NTREE_PREFETCH(ahead);
+				NTREE_PREFETCH(&ahead->mChildren[N - 1]);
+			}
+
+			// Если лепесток был пересажен, то обновляем глубину его потомков до того, как их увидит walker.
+			leaf->PropagateDepth();
 
 			// Добавляем всех потомков полученного лепестка в очередь, если они есть.
 
-			for (uint16_t c = 0; c < leaf->mChildrenAmount; c++)
+			uint16_t childrenAmount = leaf->LoadChildrenAmount();
+
+			for (uint16_t c = 0; c < childrenAmount; c++)
 			{
-				collected.push(leaf->mChildren[c]);
+				NLeaf<T, N>* child = leaf->LoadNChild(c);
+
+				if (child != nullptr)
+				{
+					collected.push_back(child);
+				}
 			}
 
 			// Вызываем переданную в Walk лямбду и передаём туда полученный лепесток. Ожидаем, чтобы она вернула bool.
@@ -182,16 +288,296 @@ public:
 		mChildren[index] = leaf;
 
 		mChildren[index]->mChildIndex = index;
-		mChildren[index]->mDepth = mDepth + 1;
+		mChildren[index]->mParent = this;
+		mChildren[index]->MoveToDepth(mDepth + 1);
 
 		mChildrenAmount++;
+
+		InvalidateHash();
+	}
+
+	/*
+		Параллельное добавление потомка без блокировок. Можно вызывать из многих потоков
+		одновременно на одном и том же родителе.
+
+		Слот захватывается атомарным CAS на mChildrenAmount, после чего потомку выставляются
+		индекс и глубина, и только затем указатель публикуется в mChildren с memory_order_release.
+		Walk читает количество потомков и указатели с memory_order_acquire, поэтому читатель,
+		увидевший потомка, гарантированно видит и его значение, индекс, глубину и всех потомков,
+		опубликованных до него. Захваченный, но ещё не опубликованный слот читатель пропускает.
+
+		Возвращает индекс, куда был добавлен потомок, или N, если свободных слотов не осталось.
+		Обычный SetNChild потокобезопасным не является и смешивать его с этим методом на одном
+		родителе нельзя.
+	*/
+	uint16_t AttachNChildConcurrent(NLeaf<T, N>* leaf)
+	{
+		std::atomic_ref<uint16_t> amount(mChildrenAmount);
+
+		// Захватываем слот.
+		uint16_t index = amount.load(std::memory_order_relaxed);
+		do
+		{
+			if (index >= N)
+			{
+				return N;
+			}
+		} while (!amount.compare_exchange_weak(index, index + 1, std::memory_order_acq_rel, std::memory_order_relaxed));
+
+		// Пока потомок не опубликован, его никто кроме нас не видит, поэтому и глубину поддерева обновляем сразу.
+		leaf->mChildIndex = index;
+		leaf->mParent = this;
+		leaf->RefreshDepthAt(mDepth + 1);
+
+		// Публикуем потомка.
+		std::atomic_ref<NLeaf<T, N>*>(mChildren[index]).store(leaf, std::memory_order_release);
+
+		InvalidateHash();
+
+		return index;
+	}
+
+	/*
+		Замена потомка по индексу при одновременно работающих читателях (Walk, GetNChild).
+		Если leaf равен nullptr, то потомок просто отсоединяется и на его месте остаётся
+		пустой слот, который Walk пропускает.
+
+		Возвращает старого потомка. Удалять его сразу нельзя, так как читатели могут всё ещё
+		по нему идти: его нужно отдать в EpochDomain::Retire (см. epoch.hpp).
+		Рассчитан на одного писателя на родителя.
+	*/
+	NLeaf<T, N>* ReplaceNChild(uint16_t index, NLeaf<T, N>* leaf)
+	{
+		if (leaf != nullptr)
+		{
+			leaf->mChildIndex = index;
+			leaf->mParent = this;
+			leaf->RefreshDepthAt(mDepth + 1);
+		}
+
+		NLeaf<T, N>* previous = std::atomic_ref<NLeaf<T, N>*>(mChildren[index]).exchange(leaf, std::memory_order_acq_rel);
+
+		InvalidateHash();
+
+		return previous;
 	}
 	
-	// Получение потомков соответственно.
+	/*
+		Отсоединение потомка по индексу за O(N): потомки правее сдвигаются на его место.
+		Отсоединённое поддерево становится самостоятельным деревом с корнем глубины 0,
+		глубина его потомков обновляется лениво при следующем Walk (см. GraftNChild).
+		Не для параллельного режима: там нужно использовать ReplaceNChild.
+	*/
+	NLeaf<T, N>* DetachNChild(uint16_t index)
+	{
+		NLeaf<T, N>* leaf = mChildren[index];
+
+		for (uint16_t c = index + 1; c < mChildrenAmount; c++)
+		{
+			mChildren[c - 1] = mChildren[c];
+
+			if (mChildren[c - 1] != nullptr)
+			{
+				mChildren[c - 1]->mChildIndex = c - 1;
+			}
+		}
+
+		mChildrenAmount--;
+		mChildren[mChildrenAmount] = nullptr;
+
+		// Хэш самого отсоединённого поддерева от его места не зависит и остаётся действительным.
+		InvalidateHash();
+
+		if (leaf != nullptr)
+		{
+			leaf->mParent = nullptr;
+			leaf->mChildIndex = 0;
+			leaf->MoveToDepth(0);
+		}
+
+		return leaf;
+	}
+
+	/*
+		Пересадка поддерева последним потомком этого лепестка за O(1).
+
+		Глубина самого пересаженного лепестка выставляется сразу, а его потомков - лениво:
+		лепесток помечается флагом, и каждый Walk, проходящий через помеченный лепесток,
+		обновляет глубину его детей и переносит флаг на них. Сериализация и все операции через
+		Walk поэтому всегда видят правильную глубину. Чтобы обновить всё сразу, есть RefreshDepth.
+
+		Возвращает индекс потомка или N, если свободных слотов не осталось.
+	*/
+	uint16_t GraftNChild(NLeaf<T, N>* leaf)
+	{
+		if (mChildrenAmount >= N)
+		{
+			return N;
+		}
+
+		uint16_t index = mChildrenAmount;
+
+		mChildren[index] = leaf;
+		mChildrenAmount++;
+
+		leaf->mParent = this;
+		leaf->mChildIndex = index;
+		leaf->MoveToDepth(mDepth + 1);
+
+		InvalidateHash();
+
+		return index;
+	}
+
+	/*
+		Отсоединение этого лепестка вместе с поддеревом от его родителя.
+		Возвращает сам лепесток, который теперь является корнем самостоятельного дерева.
+	*/
+	NLeaf<T, N>* DetachSubtree()
+	{
+		if (mParent == nullptr)
+		{
+			return this;
+		}
+
+		return mParent->DetachNChild(mChildIndex);
+	}
+
+	/*
+		Удаление потомка по индексу вместе со всем его поддеревом.
+		Для лепестков из NArena нужно использовать NArena::RemoveNChild, который вернёт их
+		в список свободных лепестков вместо delete.
+	*/
+	void RemoveNChild(uint16_t index)
+	{
+		delete DetachNChild(index);
+	}
+
+	/*
+		Настройка предвыборки в Walk для всех деревьев этого типа.
+		Подобрать значение под размер дерева помогает SuggestPrefetchDistance.
+	*/
+	static void SetPrefetchDistance(uint16_t distance)
+	{
+		sPrefetchDistance = distance;
+	}
+
+	/*
+		Рекомендуемая дистанция предвыборки для дерева из leafAmount лепестков.
+		Пока дерево помещается в кэш последнего уровня, предвыборка только мешает. Дальше
+		дистанция растёт вместе с размером дерева, пока не упрётся в число одновременных
+		промахов, которые держит ядро.
+	*/
+	static uint16_t SuggestPrefetchDistance(size_t leafAmount)
+	{
+		// В uint64_t, так как на 32-битной платформе 4 ГБ в size_t не помещаются.
+		uint64_t bytes = (uint64_t)leafAmount * sizeof(NLeaf<T, N>);
+
+		if (bytes <= (uint64_t)8 * 1024 * 1024)
+		{
+			return 0;
+		}
+
+		if (bytes <= (uint64_t)256 * 1024 * 1024)
+		{
+			return 4;
+		}
+
+		if (bytes <= (uint64_t)4 * 1024 * 1024 * 1024)
+		{
+			return 8;
+		}
+
+		return 16;
+	}
+
+	// Немедленное обновление глубины во всём поддереве после пересадок.
+	void RefreshDepth()
+	{
+		Walk([](NLeaf<T, N>* leaf) -> bool {
+			return false;
+		});
+	}
+
+	/*
+		Хэш поддерева этого лепестка: значение лепестка, смешанное с хэшами потомков и их индексами.
+		Хэши кэшируются в каждом лепестке, а любое изменение помечает устаревшими только путь
+		до корня. Поэтому первый вызов стоит O(n), а после правок пересчитываются только
+		изменившиеся поддеревья. Равные хэши означают равные поддеревья с точностью до
+		коллизии 64-битного хэша.
+
+		threads - количество потоков для пересчёта: верх дерева разбирается в ширину, пока не
+		наберётся достаточно независимых устаревших поддеревьев, которые считаются параллельно.
+		Не вызывать одновременно с изменениями дерева.
+	*/
+	uint64_t GetHash(uint16_t threads = 1)
+	{
+		if ((mFlags & LEAF_FLAG_STALE_HASH) == 0)
+		{
+			return mHash;
+		}
+
+		if (threads <= 1)
+		{
+			RehashSubtree();
+
+			return mHash;
+		}
+
+		// Верхние лепестки считаются после всех поддеревьев, поддеревья - по одному на поток за раз.
+		std::vector<NLeaf<T, N>*> top = {};
+		std::vector<NLeaf<T, N>*> subtrees = { this };
+
+		while (subtrees.size() > 0 && subtrees.size() < (size_t)threads * 4)
+		{
+			std::vector<NLeaf<T, N>*> next = {};
+
+			for (NLeaf<T, N>* leaf : subtrees)
+			{
+				top.push_back(leaf);
+
+				for (uint16_t c = 0; c < leaf->mChildrenAmount; c++)
+				{
+					if (leaf->mChildren[c] != nullptr && (leaf->mChildren[c]->mFlags & LEAF_FLAG_STALE_HASH))
+					{
+						next.push_back(leaf->mChildren[c]);
+					}
+				}
+			}
+
+			subtrees.swap(next);
+		}
+
+		std::vector<std::thread> workers = {};
+		for (uint16_t t = 0; t < threads; t++)
+		{
+			workers.emplace_back([&subtrees, t, threads]() {
+				for (size_t s = t; s < subtrees.size(); s += threads)
+				{
+					subtrees[s]->RehashSubtree();
+				}
+			});
+		}
+
+		for (std::thread& worker : workers)
+		{
+			worker.join();
+		}
+
+		// top собран в порядке обхода в ширину, поэтому с конца потомки пересчитываются раньше родителей.
+		for (size_t l = top.size(); l > 0; l--)
+		{
+			top[l - 1]->Rehash();
+		}
+
+		return mHash;
+	}
+
+	// Получение потомков соответственно. Безопасно вызывать одновременно с ReplaceNChild.
 
 	NLeaf<T, N>* GetNChild(uint16_t index) const
 	{
-		return mChildren[index];
+		return LoadNChild(index);
 	}
 
 	/* 
@@ -214,6 +600,8 @@ public:
 	void SetValue(T value)
 	{
 		mValue = value;
+
+		InvalidateHash();
 	}
 
 	// Получение глубины этого лепестка.
@@ -232,6 +620,217 @@ public:
 	{
 		return mChildIndex;
 	}
+
+	NLeaf<T, N>* GetParent()
+	{
+		return mParent;
+	}
+private:
+	// Смена глубины лепестка. Если она поменялась и есть потомки, то они помечаются на ленивое обновление.
+	void MoveToDepth(uint16_t depth)
+	{
+		if (mDepth != depth)
+		{
+			mDepth = depth;
+
+			if (mChildrenAmount > 0)
+			{
+				mFlags |= LEAF_FLAG_STALE_DEPTH;
+			}
+		}
+	}
+
+	/*
+		Смена глубины с немедленным обновлением всего поддерева. Используется перед публикацией
+		поддерева читателям, чтобы Walk в параллельном режиме никогда ничего не записывал.
+	*/
+	void RefreshDepthAt(uint16_t depth)
+	{
+		MoveToDepth(depth);
+
+		if (mFlags & LEAF_FLAG_STALE_DEPTH)
+		{
+			RefreshDepth();
+		}
+	}
+
+	// Ленивое обновление глубины: переносит правильную глубину и флаг на потомков.
+	void PropagateDepth()
+	{
+		// Флаги читаются атомарно: параллельный AttachNChildConcurrent может в это время помечать хэш.
+		if ((std::atomic_ref<uint16_t>(mFlags).load(std::memory_order_relaxed) & LEAF_FLAG_STALE_DEPTH) == 0)
+		{
+			return;
+		}
+
+		for (uint16_t c = 0; c < mChildrenAmount; c++)
+		{
+			if (mChildren[c] != nullptr)
+			{
+				mChildren[c]->MoveToDepth(mDepth + 1);
+			}
+		}
+
+		mFlags &= ~LEAF_FLAG_STALE_DEPTH;
+	}
+
+	// Атомарное чтение количества потомков и указателя на потомка. Парные к публикации в AttachNChildConcurrent.
+
+	uint16_t LoadChildrenAmount() const
+	{
+		return std::atomic_ref<uint16_t>(const_cast<uint16_t&>(mChildrenAmount)).load(std::memory_order_acquire);
+	}
+
+	NLeaf<T, N>* LoadNChild(uint16_t index) const
+	{
+		return std::atomic_ref<NLeaf<T, N>*>(const_cast<NLeaf<T, N>*&>(mChildren[index])).load(std::memory_order_acquire);
+	}
+
+	/*
+		Пометка хэша этого лепестка и его предков устаревшим. Флаг ставится атомарно, так как
+		AttachNChildConcurrent может помечать общих предков из нескольких потоков сразу.
+	*/
+	void InvalidateHash()
+	{
+		for (NLeaf<T, N>* leaf = this; leaf != nullptr; leaf = leaf->mParent)
+		{
+			uint16_t previous = std::atomic_ref<uint16_t>(leaf->mFlags).fetch_or(LEAF_FLAG_STALE_HASH, std::memory_order_relaxed);
+			if (previous & LEAF_FLAG_STALE_HASH)
+			{
+				break;
+			}
+		}
+	}
+
+	// Пересчёт хэша лепестка по его значению и уже актуальным хэшам потомков вместе с их индексами.
+	void Rehash()
+	{
+		uint64_t hash = MixHash(std::hash<T>()(mValue));
+
+		for (uint16_t c = 0; c < mChildrenAmount; c++)
+		{
+			if (mChildren[c] != nullptr)
+			{
+				hash = MixHash(hash ^ (mChildren[c]->mHash + c + 1));
+			}
+		}
+
+		mHash = hash;
+		mFlags &= ~LEAF_FLAG_STALE_HASH;
+	}
+
+	// Пересчёт всех устаревших хэшей поддерева. В актуальные поддеревья не заходит.
+	void RehashSubtree()
+	{
+		std::vector<NLeaf<T, N>*> stale = {};
+		std::vector<NLeaf<T, N>*> toVisit = { this };
+
+		while (toVisit.size() > 0)
+		{
+			NLeaf<T, N>* leaf = toVisit.back();
+			toVisit.pop_back();
+
+			stale.push_back(leaf);
+
+			for (uint16_t c = 0; c < leaf->mChildrenAmount; c++)
+			{
+				if (leaf->mChildren[c] != nullptr && (leaf->mChildren[c]->mFlags & LEAF_FLAG_STALE_HASH))
+				{
+					toVisit.push_back(leaf->mChildren[c]);
+				}
+			}
+		}
+
+		// Потомки попали в список позже родителей, поэтому с конца они пересчитываются раньше.
+		for (size_t l = stale.size(); l > 0; l--)
+		{
+			stale[l - 1]->Rehash();
+		}
+	}
+
+	// Перемешивание битов хэша (финализатор splitmix64).
+	static uint64_t MixHash(uint64_t hash)
+	{
+		hash += 0x9e3779b97f4a7c15;
+		hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9;
+		hash = (hash ^ (hash >> 27)) * 0x94d049bb133111eb;
+
+		return hash ^ (hash >> 31);
+	}
+public:
+	/*
+		Глубокое копирование поддерева этого лепестка. Копия - самостоятельное дерево
+		с корнем глубины 0, каждый лепесток выделяется через new.
+		Для копирования целым блоком в непрерывную память есть CloneInto и NArena::Clone.
+	*/
+	NLeaf<T, N>* Clone()
+	{
+		return CloneWith([](T value) -> NLeaf<T, N>* {
+			return new NLeaf<T, N>(value);
+		});
+	}
+
+	/*
+		Глубокое копирование поддерева в NArena. Место под все лепестки резервируется заранее,
+		поэтому копия ложится в память одним непрерывным блоком в порядке обхода в ширину.
+	*/
+	NLeaf<T, N>* CloneInto(NArena<T, N>& arena)
+	{
+		size_t amount = 0;
+		Walk([&](NLeaf<T, N>* leaf) -> bool {
+			amount++;
+
+			return false;
+		});
+
+		arena.Reserve(amount);
+
+		return CloneWith([&](T value) -> NLeaf<T, N>* {
+			return arena.Allocate(value);
+		});
+	}
+private:
+	// Общая часть Clone и CloneInto: копирование в ширину с заданным способом выделения лепестков.
+	template<typename A>
+	NLeaf<T, N>* CloneWith(A allocate)
+	{
+		NLeaf<T, N>* result = nullptr;
+
+		// Очередь пар "исходный лепесток - данные о месте для его копии".
+		std::queue<std::pair<NLeaf<T, N>*, leaf_generation_data_t<T, N>>> toCopy = {};
+		toCopy.push({ this, { &result, nullptr, 0 } });
+
+		while (toCopy.size() > 0)
+		{
+			NLeaf<T, N>* source = toCopy.front().first;
+			const leaf_generation_data_t<T, N>& leafData = toCopy.front().second;
+
+			(*leafData.output) = allocate(source->mValue);
+
+			if (leafData.parent != nullptr)
+			{
+				leafData.parent->SetNChild(leafData.childIndex, (*leafData.output));
+			}
+
+			// Пустые слоты после ReplaceNChild в копию не переносим.
+			uint16_t childIndex = 0;
+			for (uint16_t c = 0; c < source->mChildrenAmount; c++)
+			{
+				NLeaf<T, N>* child = source->mChildren[c];
+				if (child == nullptr)
+				{
+					continue;
+				}
+
+				toCopy.push({ child, { (*leafData.output)->GetNChild(childIndex), (*leafData.output), childIndex } });
+				childIndex++;
+			}
+
+			toCopy.pop();
+		}
+
+		return result;
+	}
 public:
 	/*
 		Этот метод просто проходится по всем потомкам, включая текущий лепесток, и находит максимальное количество ветвлений.
@@ -285,8 +884,15 @@ public:
 				stream << leaf->mDepth << ": ";
 			}
 			
+			// Пустые слоты, оставшиеся после ReplaceNChild(index, nullptr), Walk пропускает, поэтому и считать их не нужно.
+			uint16_t childrenAmount = 0;
+			for (uint16_t c = 0; c < leaf->mChildrenAmount; c++)
+			{
+				childrenAmount += (leaf->mChildren[c] != nullptr) ? 1 : 0;
+			}
+
 			// Вывод количество детей лепестка, разделителя, значения лепестка и перенос на следующую строку.
-			stream << leaf->mChildrenAmount << ":" << leaf->mValue << std::endl;
+			stream << childrenAmount << ":" << leaf->mValue << std::endl;
 
 			// Если skipDeep включен и мы его достигли по глубине, то не продолжать дальше выводить лепестки.
 			if (skipDeep != -1 && leaf->mDepth > skipDeep)
@@ -0,0 +1,412 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+	Общие вспомогательные части плоских структур и параллельных построений:
+	- NParallel - деление диапазона между потоками;
+	- NBufferLayout - раскладка буфера "заголовок и выровненные массивы" (NFlatTree, CsrGraph);
+	- NMapping - отображение файла или именованной разделяемой памяти (CsrGraph, NSharedTree).
+*/
+
+class NParallel
+{
+public:
+	/*
+		Вызов work по частям диапазона [0, amount) в threads потоках. Диапазоны меньше minimum
+		не делятся и обрабатываются в вызывающем потоке: создавать потоки дороже.
+		work принимает (начало, конец) или (начало, конец, номер потока), номера потоков идут с 0.
+	*/
+	template<typename W>
+	static void ForRange(uint64_t amount, uint16_t threads, uint64_t minimum, W work)
+	{
+		if (threads <= 1 || amount < minimum)
+		{
+			Call(work, 0, amount, 0);
+
+			return;
+		}
+
+		std::vector<std::thread> workers = {};
+		uint64_t chunk = (amount + threads - 1) / threads;
+
+		for (uint64_t begin = 0, worker = 0; begin < amount; begin += chunk, worker++)
+		{
+			workers.emplace_back([&work, begin, worker, end = std::min(begin + chunk, amount)]() {
+				Call(work, begin, end, worker);
+			});
+		}
+
+		for (std::thread& worker : workers)
+		{
+			worker.join();
+		}
+	}
+private:
+	template<typename W>
+	static void Call(W& work, uint64_t begin, uint64_t end, uint64_t worker)
+	{
+		if constexpr (std::is_invocable_v<W&, uint64_t, uint64_t, uint64_t>)
+		{
+			work(begin, end, worker);
+		}
+		else
+		{
+			work(begin, end);
+		}
+	}
+};
+
+/*
+	Раскладка буфера из заголовка и массивов, каждый из которых выровнен по ARRAY_ALIGNMENT
+	байт от начала буфера. Смещения массивов записываются в заголовок, поэтому буфер не содержит
+	указателей и читается как есть из файла, mmap или разделяемой памяти.
+*/
+class NBufferLayout
+{
+public:
+	// Выравнивание каждого массива в буфере.
+	static constexpr uint64_t ARRAY_ALIGNMENT = 64;
+private:
+	// Текущий размер буфера.
+	uint64_t mSize;
+public:
+	// Раскладка начинается с заголовка из headerSize байт.
+	NBufferLayout(uint64_t headerSize)
+	{
+		mSize = AlignUp(headerSize);
+	}
+public:
+	// Место под следующий массив из byteSize байт. Возвращает его смещение.
+	uint64_t Add(uint64_t byteSize)
+	{
+		uint64_t offset = mSize;
+		mSize = AlignUp(mSize + byteSize);
+
+		return offset;
+	}
+
+	uint64_t GetSize() const
+	{
+		return mSize;
+	}
+
+	// Буфер размера GetSize() из uint64_t, чтобы он был выровнен хотя бы по 8 байт, с заголовком header в начале.
+	template<typename H>
+	std::vector<uint64_t> Allocate(const H& header) const
+	{
+		std::vector<uint64_t> storage(mSize / sizeof(uint64_t), 0);
+		memcpy(storage.data(), &header, sizeof(header));
+
+		return storage;
+	}
+public:
+	// Массив типа A по смещению offset от начала буфера data.
+	template<typename A>
+	static A* At(const uint8_t* data, uint64_t offset)
+	{
+		return reinterpret_cast<A*>(const_cast<uint8_t*>(data) + offset);
+	}
+
+	/*
+		Лежит ли выровненный массив из length байт по смещению offset после заголовка из
+		headerSize байт внутри буфера из size байт. Для проверки буферов, которым нельзя доверять.
+	*/
+	static bool Contains(uint64_t size, uint64_t headerSize, uint64_t offset, uint64_t length)
+	{
+		return offset >= headerSize && offset % ARRAY_ALIGNMENT == 0 && offset <= size && length <= size - offset;
+	}
+
+	static uint64_t AlignUp(uint64_t size)
+	{
+		return (size + ARRAY_ALIGNMENT - 1) / ARRAY_ALIGNMENT * ARRAY_ALIGNMENT;
+	}
+};
+
+/*
+	Отображение в память файла (только для чтения) или именованной разделяемой памяти.
+	Отображение держит файл или сегмент само, описатели после открытия закрываются
+	(кроме описателя сегмента в Windows: сегмент живёт, пока он открыт).
+*/
+class NMapping
+{
+private:
+	void* mData = nullptr;
+	size_t mSize = 0;
+
+#if defined(_WIN32)
+	HANDLE mHandle = nullptr;
+#endif
+public:
+	NMapping() = default;
+
+	~NMapping()
+	{
+		Close();
+	}
+
+	NMapping(const NMapping&) = delete;
+	NMapping& operator=(const NMapping&) = delete;
+
+	NMapping(NMapping&& other) noexcept
+	{
+		*this = std::move(other);
+	}
+
+	NMapping& operator=(NMapping&& other) noexcept
+	{
+		if (this != &other)
+		{
+			Close();
+
+			mData = other.mData;
+			mSize = other.mSize;
+			other.mData = nullptr;
+			other.mSize = 0;
+
+#if defined(_WIN32)
+			mHandle = other.mHandle;
+			other.mHandle = nullptr;
+#endif
+		}
+
+		return *this;
+	}
+public:
+	// Отображение файла path только для чтения. Пустой файл не отображается.
+	bool OpenFile(const std::string& path)
+	{
+		Close();
+
+#if defined(_WIN32)
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+
+		LARGE_INTEGER size = {};
+		BOOL sized = GetFileSizeEx(file, &size);
+
+		HANDLE mapping = (sized && size.QuadPart > 0) ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+		CloseHandle(file);
+
+		if (mapping == nullptr)
+		{
+			return false;
+		}
+
+		mData = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+
+		mSize = (mData != nullptr) ? (size_t)size.QuadPart : 0;
+#else
+		int descriptor = open(path.c_str(), O_RDONLY);
+		if (descriptor < 0)
+		{
+			return false;
+		}
+
+		struct stat status = {};
+		bool sized = fstat(descriptor, &status) == 0 && status.st_size > 0;
+
+		void* mapping = sized ? mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_SHARED, descriptor, 0) : MAP_FAILED;
+		close(descriptor);
+
+		if (mapping != MAP_FAILED)
+		{
+			mData = mapping;
+			mSize = (size_t)status.st_size;
+		}
+#endif
+
+		return mData != nullptr;
+	}
+
+	/*
+		Создание сегмента разделяемой памяти name размером byteSize для чтения и записи
+		(в POSIX имя начинается с '/'). Существующий сегмент не перезаписывается на месте:
+		в POSIX старое имя удаляется и создаётся новый сегмент, а уже отображённые читатели
+		остаются со старым; в Windows имя нельзя освободить, пока сегмент открыт, поэтому
+		создание под занятым именем не удаётся.
+	*/
+	bool CreateShared(const std::string& name, size_t byteSize)
+	{
+		Close();
+
+		if (byteSize <= 0)
+		{
+			return false;
+		}
+
+#if defined(_WIN32)
+		uint64_t size = byteSize;
+		mHandle = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)(size & 0xFFFFFFFF), name.c_str());
+
+		// Имя занято живым сегментом: писать в него нельзя, его читают.
+		if (mHandle != nullptr && GetLastError() == ERROR_ALREADY_EXISTS)
+		{
+			CloseHandle(mHandle);
+			mHandle = nullptr;
+		}
+
+		return MapShared(byteSize, FILE_MAP_WRITE);
+#else
+		shm_unlink(name.c_str());
+
+		int descriptor = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+		if (descriptor < 0)
+		{
+			return false;
+		}
+
+		if (ftruncate(descriptor, (off_t)byteSize) != 0)
+		{
+			close(descriptor);
+			shm_unlink(name.c_str());
+
+			return false;
+		}
+
+		return MapShared(descriptor, byteSize, PROT_READ | PROT_WRITE);
+#endif
+	}
+
+	// Отображение существующего сегмента разделяемой памяти name только для чтения.
+	bool OpenShared(const std::string& name)
+	{
+		Close();
+
+#if defined(_WIN32)
+		mHandle = OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+
+		return MapShared(0, FILE_MAP_READ);
+#else
+		int descriptor = shm_open(name.c_str(), O_RDONLY, 0);
+		if (descriptor < 0)
+		{
+			return false;
+		}
+
+		struct stat status = {};
+		if (fstat(descriptor, &status) != 0)
+		{
+			close(descriptor);
+
+			return false;
+		}
+
+		return MapShared(descriptor, (size_t)status.st_size, PROT_READ);
+#endif
+	}
+
+	// Удаление имени сегмента. Уже отображённые сегменты продолжают читаться, пока не закрыты.
+	static void UnlinkShared(const std::string& name)
+	{
+#if !defined(_WIN32)
+		shm_unlink(name.c_str());
+#endif
+	}
+
+	void Close()
+	{
+		if (mData != nullptr)
+		{
+#if defined(_WIN32)
+			UnmapViewOfFile(mData);
+#else
+			munmap(mData, mSize);
+#endif
+		}
+
+#if defined(_WIN32)
+		if (mHandle != nullptr)
+		{
+			CloseHandle(mHandle);
+			mHandle = nullptr;
+		}
+#endif
+
+		mData = nullptr;
+		mSize = 0;
+	}
+public:
+	void* GetData() const
+	{
+		return mData;
+	}
+
+	// Размер отображения. В Windows для открытого сегмента - размер области, округлённый до страниц.
+	size_t GetSize() const
+	{
+		return mSize;
+	}
+
+	bool IsOpen() const
+	{
+		return mData != nullptr;
+	}
+private:
+#if defined(_WIN32)
+	// Отображение сегмента mHandle. При ошибке описатель закрывается.
+	bool MapShared(size_t byteSize, DWORD access)
+	{
+		if (mHandle == nullptr)
+		{
+			return false;
+		}
+
+		mData = MapViewOfFile(mHandle, access, 0, 0, byteSize);
+		if (mData == nullptr)
+		{
+			CloseHandle(mHandle);
+			mHandle = nullptr;
+
+			return false;
+		}
+
+		// Размер открытого сегмента узнаём у самой памяти.
+		MEMORY_BASIC_INFORMATION info = {};
+		VirtualQuery(mData, &info, sizeof(info));
+		mSize = (byteSize > 0) ? byteSize : info.RegionSize;
+
+		return true;
+	}
+#else
+	// Отображение сегмента по дескриптору, который после этого закрывается.
+	bool MapShared(int descriptor, size_t byteSize, int protection)
+	{
+		void* mapping = (byteSize > 0) ? mmap(nullptr, byteSize, protection, MAP_SHARED, descriptor, 0) : MAP_FAILED;
+		close(descriptor);
+
+		if (mapping == MAP_FAILED)
+		{
+			return false;
+		}
+
+		mData = mapping;
+		mSize = byteSize;
+
+		return true;
+	}
+#endif
+};
@@ -0,0 +1,379 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "ntree.hpp"
+
+// Объявление версионного дерева наперёд.
+template<typename T, uint16_t N>
+class PNTree;
+
+/*
+	Неизменяемый лепесток персистентного дерева.
+
+	После создания лепесток никогда не меняется, поэтому одно и то же поддерево
+	может одновременно принадлежать многим версиям дерева. Потомки хранятся через
+	shared_ptr: лепесток удаляется, когда на него не ссылается ни одна версия.
+*/
+template<typename T, uint16_t N>
+class PNLeaf
+{
+	friend class PNTree<T, N>;
+private:
+	// Значение лепестка.
+	T mValue;
+
+	// Глубина лепестка.
+	uint16_t mDepth;
+
+	// Индекс лепестка в массиве потомков.
+	uint16_t mChildIndex;
+
+	// Количество детей данного лепестка.
+	uint16_t mChildrenAmount;
+
+	// Потомки лепестка, общие для всех версий, где они не менялись.
+	std::shared_ptr<const PNLeaf<T, N>> mChildren[N];
+public:
+	// Конструктор лепестка, задающий изначальное значение.
+	PNLeaf(T value)
+	{
+		mValue = value;
+
+		mDepth = 0;
+		mChildIndex = 0;
+
+		mChildrenAmount = 0;
+	}
+public:
+	// Получение потомка по индексу.
+
+	const PNLeaf<T, N>* GetNChild(uint16_t index) const
+	{
+		return mChildren[index].get();
+	}
+
+	// Получение значения, глубины, количества детей и индекса этого лепестка.
+
+	T GetValue() const
+	{
+		return mValue;
+	}
+
+	uint16_t GetDepth() const
+	{
+		return mDepth;
+	}
+
+	uint16_t GetChildAmount() const
+	{
+		return mChildrenAmount;
+	}
+
+	uint16_t GetChildIndex() const
+	{
+		return mChildIndex;
+	}
+};
+
+/*
+	Версионное (персистентное) N дерево с копированием при записи.
+
+	Каждое изменение (установка значения, добавление потомка) копирует только путь от корня
+	до изменяемого лепестка, а всё остальное делит с предыдущей версией. Поэтому изменение стоит
+	O(глубина), а любая старая версия остаётся целой и доступной для чтения, например для
+	Serialize, пока писатель продолжает создавать новые версии.
+
+	Лепестки адресуются путём - последовательностью индексов потомков от корня.
+	Пустой путь означает сам корень.
+*/
+template<typename T, uint16_t N>
+class PNTree
+{
+public:
+	// Указатель на корень версии. Пока он жив, версия не будет удалена.
+	using version_t = std::shared_ptr<const PNLeaf<T, N>>;
+
+	// Путь от корня до лепестка.
+	using path_t = std::vector<uint16_t>;
+
+	// Callback итерации по версии. Смысл возвращаемого значения такой же, как в NLeaf::Walk.
+	using walk_callback_t = std::function<bool(const PNLeaf<T, N>*)>;
+
+	// Номер версии, возвращаемый при ошибке (неверный путь или переполненный лепесток).
+	static constexpr size_t INVALID_VERSION = SIZE_MAX;
+private:
+	// Корни всех версий по порядку.
+	std::vector<version_t> mVersions;
+
+	// Мьютекс для списка версий. Сами версии неизменяемы и блокировок не требуют.
+	std::mutex mVersionsMutex;
+public:
+	// Создание дерева с единственной версией из одного корня.
+	PNTree(T rootValue)
+	{
+		mVersions.push_back(std::make_shared<const PNLeaf<T, N>>(rootValue));
+	}
+
+	// Создание первой версии полным копированием обычного дерева.
+	PNTree(NLeaf<T, N>* tree)
+	{
+		mVersions.push_back(CopyFromTree(tree));
+	}
+public:
+	// Количество версий.
+	size_t GetVersionAmount()
+	{
+		std::lock_guard<std::mutex> lock(mVersionsMutex);
+
+		return mVersions.size();
+	}
+
+	/*
+		Получение версии по номеру. Возвращённый указатель держит версию живой.
+		Для номера, которого нет или версия которого забыта, возвращается nullptr.
+	*/
+	version_t GetVersion(size_t version)
+	{
+		std::lock_guard<std::mutex> lock(mVersionsMutex);
+
+		if (version >= mVersions.size())
+		{
+			return nullptr;
+		}
+
+		return mVersions[version];
+	}
+
+	// Получение последней версии.
+	version_t GetLatest()
+	{
+		std::lock_guard<std::mutex> lock(mVersionsMutex);
+
+		return mVersions.back();
+	}
+
+	/*
+		Забывает все версии старше keepFrom. Лепестки, на которые больше не ссылается
+		ни одна оставшаяся версия, освобождаются автоматически счётчиком ссылок.
+		Последняя версия не забывается никогда: от неё строятся следующие.
+	*/
+	void DropVersionsBefore(size_t keepFrom)
+	{
+		std::lock_guard<std::mutex> lock(mVersionsMutex);
+
+		for (size_t v = 0; v < keepFrom && v + 1 < mVersions.size(); v++)
+		{
+			mVersions[v].reset();
+		}
+	}
+public:
+	/*
+		Создаёт новую версию из последней, в которой у лепестка по пути path значение равно value.
+		Возвращает номер новой версии или INVALID_VERSION, если путь неверный.
+	*/
+	size_t SetValue(const path_t& path, T value)
+	{
+		return Modify(path, [&](PNLeaf<T, N>& leaf) -> bool {
+			leaf.mValue = value;
+
+			return true;
+		});
+	}
+
+	/*
+		Создаёт новую версию из последней, в которой к лепестку по пути path добавлен новый потомок
+		со значением value. Возвращает номер новой версии или INVALID_VERSION, если путь неверный
+		или у лепестка уже N потомков.
+	*/
+	size_t AttachNChild(const path_t& path, T value)
+	{
+		return Modify(path, [&](PNLeaf<T, N>& leaf) -> bool {
+			if (leaf.mChildrenAmount >= N)
+			{
+				return false;
+			}
+
+			std::shared_ptr<PNLeaf<T, N>> child = std::make_shared<PNLeaf<T, N>>(value);
+			child->mDepth = leaf.mDepth + 1;
+			child->mChildIndex = leaf.mChildrenAmount;
+
+			leaf.mChildren[leaf.mChildrenAmount++] = child;
+
+			return true;
+		});
+	}
+public:
+	// Итерация в ширину по версии. Работает так же, как NLeaf::Walk. Пустая (забытая) версия не обходится.
+	static void Walk(const version_t& version, walk_callback_t walker)
+	{
+		if (version == nullptr)
+		{
+			return;
+		}
+
+		std::queue<const PNLeaf<T, N>*> collected = {};
+		collected.push(version.get());
+
+		while (collected.size() > 0)
+		{
+			const PNLeaf<T, N>* leaf = collected.front();
+			collected.pop();
+
+			for (uint16_t c = 0; c < leaf->mChildrenAmount; c++)
+			{
+				collected.push(leaf->mChildren[c].get());
+			}
+
+			if (walker(leaf))
+			{
+				break;
+			}
+		}
+	}
+
+	/*
+		Сериализация версии в том же формате, что и NLeaf::Serialize, поэтому результат читает NLeaf::Deserialize.
+		Пустая версия ничего не пишет.
+	*/
+	static void Serialize(const version_t& version, std::ostream& stream)
+	{
+		Walk(version, [&](const PNLeaf<T, N>* leaf) -> bool {
+			stream << leaf->mChildrenAmount << ":" << leaf->mValue << std::endl;
+
+			return false;
+		});
+	}
+
+	// Материализация версии в обычное изменяемое дерево (полная копия). Для пустой версии возвращается nullptr.
+	static NLeaf<T, N>* ToTree(const version_t& version)
+	{
+		NLeaf<T, N>* result = nullptr;
+
+		if (version == nullptr)
+		{
+			return result;
+		}
+
+		std::queue<std::pair<const PNLeaf<T, N>*, leaf_generation_data_t<T, N>>> toCopy = {};
+		toCopy.push({ version.get(), { &result, nullptr, 0 } });
+
+		while (toCopy.size() > 0)
+		{
+			const PNLeaf<T, N>* source = toCopy.front().first;
+			const leaf_generation_data_t<T, N>& leafData = toCopy.front().second;
+
+			(*leafData.output) = new NLeaf<T, N>(source->mValue);
+
+			if (leafData.parent != nullptr)
+			{
+				leafData.parent->SetNChild(leafData.childIndex, (*leafData.output));
+			}
+
+			for (uint16_t c = 0; c < source->mChildrenAmount; c++)
+			{
+				toCopy.push({ source->mChildren[c].get(), { (*leafData.output)->GetNChild(c), (*leafData.output), c } });
+			}
+
+			toCopy.pop();
+		}
+
+		return result;
+	}
+private:
+	/*
+		Общая часть изменений: копирует путь до лепестка, применяет к копии лепестка modify
+		и публикует новый корень как новую версию.
+
+		Путь копируется без блокировки. Если за это время другой писатель опубликовал свою версию,
+		то копия выбрасывается и изменение повторяется поверх новой последней версии, иначе
+		одно из изменений потерялось бы. Поэтому modify может быть вызван несколько раз.
+	*/
+	size_t Modify(const path_t& path, const std::function<bool(PNLeaf<T, N>&)>& modify)
+	{
+		while (true)
+		{
+			version_t base = GetLatest();
+
+			// Собираем исходные лепестки на пути, заодно проверяя его.
+			std::vector<const PNLeaf<T, N>*> sources = { base.get() };
+			for (uint16_t index : path)
+			{
+				const PNLeaf<T, N>* leaf = sources.back();
+
+				if (index >= leaf->mChildrenAmount)
+				{
+					return INVALID_VERSION;
+				}
+
+				sources.push_back(leaf->mChildren[index].get());
+			}
+
+			// Копируем изменяемый лепесток. Копия делит всех потомков с оригиналом.
+			std::shared_ptr<PNLeaf<T, N>> copy = std::make_shared<PNLeaf<T, N>>(*sources.back());
+			if (!modify(*copy))
+			{
+				return INVALID_VERSION;
+			}
+
+			// Поднимаемся к корню, копируя каждого предка и подменяя в нём одного потомка.
+			for (size_t p = path.size(); p > 0; p--)
+			{
+				std::shared_ptr<PNLeaf<T, N>> parent = std::make_shared<PNLeaf<T, N>>(*sources[p - 1]);
+				parent->mChildren[path[p - 1]] = copy;
+
+				copy = parent;
+			}
+
+			std::lock_guard<std::mutex> lock(mVersionsMutex);
+
+			if (mVersions.back() == base)
+			{
+				mVersions.push_back(copy);
+
+				return mVersions.size() - 1;
+			}
+		}
+	}
+
+	// Полное копирование обычного дерева в неизменяемые лепестки.
+	static version_t CopyFromTree(NLeaf<T, N>* tree)
+	{
+		std::shared_ptr<PNLeaf<T, N>> root = std::make_shared<PNLeaf<T, N>>(tree->GetValue());
+
+		// Очередь пар "исходный лепесток - его копия", копия заполняется потомками.
+		std::queue<std::pair<NLeaf<T, N>*, PNLeaf<T, N>*>> toCopy = {};
+		toCopy.push({ tree, root.get() });
+
+		while (toCopy.size() > 0)
+		{
+			NLeaf<T, N>* source = toCopy.front().first;
+			PNLeaf<T, N>* copy = toCopy.front().second;
+			toCopy.pop();
+
+			for (uint16_t c = 0; c < source->GetChildAmount(); c++)
+			{
+				NLeaf<T, N>* child = *source->GetNChild(c);
+
+				// Пустые слоты после ReplaceNChild пропускаем.
+				if (child == nullptr)
+				{
+					continue;
+				}
+
+				std::shared_ptr<PNLeaf<T, N>> childCopy = std::make_shared<PNLeaf<T, N>>(child->GetValue());
+				childCopy->mDepth = copy->mDepth + 1;
+				childCopy->mChildIndex = copy->mChildrenAmount;
+
+				copy->mChildren[copy->mChildrenAmount++] = childCopy;
+
+				toCopy.push({ child, childCopy.get() });
+			}
+		}
+
+		return root;
+	}
+};